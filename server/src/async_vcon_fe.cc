@@ -8,14 +8,36 @@
 #include "async_vcon_fe.h"
 
 #include <l4/re/error_helper>
+#include <l4/cxx/minmax>
+#include <l4/re/env>
+#include <l4/re/util/unique_cap>
 #include <pthread.h>
+#include <pthread-l4.h>
 #include <cstdio>
+#include <cstring>
 
 using L4Re::chksys;
 
-void *Async_vcon_fe::setup()
+Async_vcon_fe::Overflow Async_vcon_fe::_dfl_overflow = Overflow_block;
+
+bool
+Async_vcon_fe::overflow_policy(char const *name)
+{
+  if (!strcmp(name, "block"))
+    _dfl_overflow = Overflow_block;
+  else if (!strcmp(name, "drop-oldest"))
+    _dfl_overflow = Overflow_drop_oldest;
+  else if (!strcmp(name, "drop"))
+    _dfl_overflow = Overflow_drop;
+  else
+    return false;
+
+  return true;
+}
+
+void Async_vcon_fe::setup()
 {
-  int err = l4_error(_vcon->bind(0, obj_cap()));
+  int err = l4_error(_vcon->bind(0, _input_irq.get()));
 
   if (err == -L4_EBADPROTO)
     printf("WARNING: frontend without input\n");
@@ -29,29 +51,264 @@ void *Async_vcon_fe::setup()
   attr.i_flags &= ~(L4_VCON_INLCR | L4_VCON_IGNCR | L4_VCON_ICRNL);
   _vcon->set_attr(&attr);
 
-  handle_pending_input();
-  _initialized = true;
+  // Input that is already pending is left to the input thread, which reads
+  // it before waiting for the first input IRQ.
+}
+
+void *Async_vcon_fe::_run(void *_self)
+{
+  Async_vcon_fe *self = static_cast<Async_vcon_fe*>(_self);
+  return self->run();
+}
+
+/**
+ * Writer thread: drain the ring to the vcon.
+ */
+void *Async_vcon_fe::run()
+{
+  setup();
+
+  char b[L4_VCON_WRITE_SIZE];
+  for (;;)
+    {
+      l4_uint32_t tail = __atomic_load_n(&_tail, __ATOMIC_ACQUIRE);
+      l4_uint32_t head = __atomic_load_n(&_head, __ATOMIC_ACQUIRE);
+      if (head == tail)
+        {
+          __atomic_store_n(&_wait_data, true, __ATOMIC_SEQ_CST);
+          // Check again, the server loop might have queued output before it
+          // could see the flag.
+          if (   __atomic_load_n(&_head, __ATOMIC_SEQ_CST) == head
+              || !__atomic_exchange_n(&_wait_data, false, __ATOMIC_SEQ_CST))
+            sem_wait(&_data);
+          continue;
+        }
+
+      unsigned n = cxx::min<unsigned>(head - tail, sizeof(b));
+      get(b, n, tail);
+
+      // If the server loop discarded the oldest output in the meantime, the
+      // copy might be overwritten already. Start over in that case.
+      if (!__atomic_compare_exchange_n(&_tail, &tail, tail + n, false,
+                                       __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        continue;
+
+      if (__atomic_exchange_n(&_wait_space, false, __ATOMIC_SEQ_CST))
+        sem_post(&_space);
+
+      vcon_write(b, n);
+    }
+
   return NULL;
 }
 
-void *Async_vcon_fe::_setup(void *_self)
+void *Async_vcon_fe::_input_run(void *_self)
 {
   Async_vcon_fe *self = static_cast<Async_vcon_fe*>(_self);
-  return self->setup();
+  return self->input_run();
+}
+
+/**
+ * Input thread: queue input for the server loop whenever the vcon signals
+ * some.
+ */
+void *Async_vcon_fe::input_run()
+{
+  L4::Cap<L4::Thread> self(pthread_l4_cap(pthread_self()));
+  chksys(_input_irq->bind_thread(self, 0), "binding input IRQ");
+
+  for (;;)
+    {
+      read_input();
+      _input_irq->receive();
+    }
+
+  return NULL;
+}
+
+void
+Async_vcon_fe::read_input()
+{
+  char b[L4_VCON_READ_SIZE];
+  bool got_input = false;
+
+  for (;;)
+    {
+      int r = _vcon->read(b, sizeof(b));
+      if (r <= 0)
+        break;
+
+      // Input not fitting into the queue is lost, like input overflowing
+      // the buffer of the vcon server.
+      l4_uint32_t head = _in_head;
+      l4_uint32_t tail = __atomic_load_n(&_in_tail, __ATOMIC_ACQUIRE);
+      unsigned n = cxx::min<unsigned>(cxx::min<unsigned>(r, sizeof(b)),
+                                      Input_ring_size - (head - tail));
+      for (unsigned i = 0; i < n; ++i)
+        _in_ring[(head + i) & (Input_ring_size - 1)] = b[i];
+      __atomic_store_n(&_in_head, head + n, __ATOMIC_RELEASE);
+      got_input |= n;
+
+      if ((unsigned)r <= sizeof(b))
+        break;
+    }
+
+  if (got_input)
+    {
+      __atomic_store_n(&_input_pending, true, __ATOMIC_RELAXED);
+      L4::cap_cast<L4::Irq>(obj_cap())->trigger();
+    }
+}
+
+/**
+ * Hand the queued input to the input mux, in the server loop.
+ */
+void
+Async_vcon_fe::handle_irq()
+{
+  __atomic_store_n(&_input_pending, false, __ATOMIC_RELAXED);
+
+  char buf[Input_ring_size];
+  l4_uint32_t tail = _in_tail;
+  l4_uint32_t head = __atomic_load_n(&_in_head, __ATOMIC_ACQUIRE);
+  unsigned n = head - tail;
+  for (unsigned i = 0; i < n; ++i)
+    buf[i] = _in_ring[(tail + i) & (Input_ring_size - 1)];
+  __atomic_store_n(&_in_tail, head, __ATOMIC_RELEASE);
+
+  if (_input && n)
+    _input->input(cxx::String(buf, n));
 }
 
 Async_vcon_fe::Async_vcon_fe(L4::Cap<L4::Vcon> con, L4Re::Util::Object_registry *r)
-: Vcon_fe_base(con, r), _initialized(false)
+: Vcon_fe_base(con, r), _overflow(_dfl_overflow),
+  _input_irq(L4Re::Util::make_unique_cap<L4::Irq>())
 {
+  sem_init(&_data, 0, 0);
+  sem_init(&_space, 0, 0);
+
+  chksys(L4Re::Env::env()->factory()->create(_input_irq.get()),
+         "creating input IRQ");
+
   pthread_t tid;
-  pthread_create(&tid, NULL, Async_vcon_fe::_setup, this);
+  pthread_create(&tid, NULL, Async_vcon_fe::_run, this);
+
+  // Let input preempt the server loop, so that long output stops promptly.
+  pthread_attr_t attr;
+  sched_param sp;
+  int policy;
+  pthread_attr_init(&attr);
+  pthread_getschedparam(pthread_self(), &policy, &sp);
+  sp.sched_priority += 1;
+  pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+  pthread_attr_setschedpolicy(&attr, policy);
+  pthread_attr_setschedparam(&attr, &sp);
+  pthread_create(&tid, &attr, Async_vcon_fe::_input_run, this);
+  pthread_attr_destroy(&attr);
+}
+
+void
+Async_vcon_fe::put(char const *buf, unsigned sz, l4_uint32_t head)
+{
+  unsigned off = head & (Ring_size - 1);
+  unsigned l = cxx::min<unsigned>(sz, Ring_size - off);
+  memcpy(_ring + off, buf, l);
+  memcpy(_ring, buf + l, sz - l);
+  __atomic_store_n(&_head, head + sz, __ATOMIC_RELEASE);
+}
+
+void
+Async_vcon_fe::get(char *buf, unsigned sz, l4_uint32_t tail) const
+{
+  unsigned off = tail & (Ring_size - 1);
+  unsigned l = cxx::min<unsigned>(sz, Ring_size - off);
+  memcpy(buf, _ring + off, l);
+  memcpy(buf + l, _ring, sz - l);
 }
 
-int
-Async_vcon_fe::write(char const *buf, unsigned sz)
+/**
+ * Hand output over to the writer thread.
+ */
+void
+Async_vcon_fe::write_out(char const *buf, unsigned sz)
 {
-  if (!_initialized)
-    return sz;
+  l4_uint32_t start = _head;
+
+  if (_overflow == Overflow_drop_oldest && sz > Ring_size)
+    {
+      buf += sz - Ring_size;
+      sz = Ring_size;
+    }
+
+  while (sz)
+    {
+      l4_uint32_t head = _head;
+      l4_uint32_t tail = __atomic_load_n(&_tail, __ATOMIC_SEQ_CST);
+      unsigned space = Ring_size - (head - tail);
+
+      if (_dropped)
+        {
+          char m[40];
+          unsigned l = snprintf(m, sizeof(m), "[%lu bytes dropped]\n",
+                                _dropped);
+          if (space < l + 1)
+            {
+              _dropped += sz;
+              break;
+            }
+
+          put(m, l, head);
+          _dropped = 0;
+          continue;
+        }
+
+      if (!space)
+        {
+          switch (_overflow)
+            {
+            case Overflow_block:
+              __atomic_store_n(&_wait_space, true, __ATOMIC_SEQ_CST);
+              if (__atomic_load_n(&_tail, __ATOMIC_SEQ_CST) == tail)
+                {
+                  wake_writer();
+                  sem_wait(&_space);
+                }
+              break;
 
-  return do_write(buf, sz);
+            case Overflow_drop_oldest:
+              // Fails if the writer thread freed some space meanwhile.
+              __atomic_compare_exchange_n(&_tail, &tail,
+                                          tail + cxx::min<unsigned>(sz, Ring_size),
+                                          false, __ATOMIC_SEQ_CST,
+                                          __ATOMIC_RELAXED);
+              break;
+
+            case Overflow_drop:
+              _dropped = sz;
+              sz = 0;
+              break;
+            }
+          continue;
+        }
+
+      unsigned n = cxx::min(sz, space);
+      put(buf, n, head);
+      buf += n;
+      sz -= n;
+    }
+
+  if (_head != start)
+    wake_writer();
+}
+
+/**
+ * Wake up the writer thread if it waits for output.
+ */
+void
+Async_vcon_fe::wake_writer()
+{
+  // Order the update of _head before reading the flag, see run().
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_exchange_n(&_wait_data, false, __ATOMIC_SEQ_CST))
+    sem_post(&_data);
 }
@@ -9,14 +9,96 @@
 
 #include "vcon_fe_base.h"
 
+#include <l4/re/util/unique_cap>
+#include <l4/sys/irq>
+
+#include <semaphore.h>
+
+/**
+ * Vcon frontend writing from a thread of its own.
+ *
+ * The server loop hands the output over through a single-producer,
+ * single-consumer byte ring, so that a slow log server does not stall the
+ * clients. What happens when the ring is full is selected with
+ * overflow_policy().
+ *
+ * Input is received by another thread with a priority above the server
+ * loop. It queues the input for the server loop and flags it, so that
+ * long output can be stopped on input without polling the vcon.
+ */
 class Async_vcon_fe : public Vcon_fe_base
 {
 public:
+  enum Overflow
+  {
+    Overflow_block,       ///< Wait for the writer thread.
+    Overflow_drop_oldest, ///< Discard the oldest output in the ring.
+    Overflow_drop,        ///< Discard new output, leave a marker.
+  };
+
   Async_vcon_fe(L4::Cap<L4::Vcon> con, L4Re::Util::Object_registry *r);
-  int write(char const *buf, unsigned sz);
+
+  int write(char const *buf, unsigned sz) override
+  { return do_write(buf, sz); }
+
+  int write(Iov const *iov, unsigned cnt) override
+  { return do_write(iov, cnt); }
+
+  void handle_irq() override;
+
+  bool check_input() override
+  { return __atomic_load_n(&_input_pending, __ATOMIC_RELAXED); }
+
+  /**
+   * Select the overflow policy for subsequently created frontends.
+   *
+   * \param name  One of `block` (the default), `drop-oldest` or `drop`.
+   *
+   * \return False if `name` is not a known policy.
+   */
+  static bool overflow_policy(char const *name);
+
+protected:
+  void write_out(char const *buf, unsigned sz) override;
 
 private:
-  static void *_setup(void *);
-  void *setup(void);
-  bool _initialized;
+  enum
+  {
+    Ring_size = 0x10000,
+    Input_ring_size = 0x1000,
+  };
+
+  static void *_run(void *);
+  void *run();
+  void setup(void);
+
+  static void *_input_run(void *);
+  void *input_run();
+  void read_input();
+
+  void put(char const *buf, unsigned sz, l4_uint32_t head);
+  void get(char *buf, unsigned sz, l4_uint32_t tail) const;
+  void wake_writer();
+
+  Overflow _overflow;
+  unsigned long _dropped = 0;
+
+  // _head is only written by the server loop. _tail is written by the
+  // writer thread and, with Overflow_drop_oldest, by the server loop.
+  l4_uint32_t _head = 0;
+  l4_uint32_t _tail = 0;
+  bool _wait_space = false;
+  bool _wait_data = false;
+  sem_t _data;
+  sem_t _space;
+  char _ring[Ring_size];
+
+  // Input queue, filled by the input thread, drained by the server loop.
+  L4Re::Util::Unique_cap<L4::Irq> _input_irq;
+  l4_uint32_t _in_head = 0;
+  l4_uint32_t _in_tail = 0;
+  bool _input_pending = false;
+  char _in_ring[Input_ring_size];
+
+  static Overflow _dfl_overflow;
 };
@@ -7,33 +7,42 @@
  */
 #include "client.h"
 #include "controller.h"
+#include "history.h"
+#include "scan.h"
 
 #include <l4/re/env.h>
 #include <l4/sys/kip.h>
+#include <l4/cxx/minmax>
 
 #include <climits>
 #include <cstring>
-#include <time.h>
 
 template<typename Client>
 void
 Client_timeout<Client>::expired()
 { _client->timeout_expired(); }
 
+bool Client::_mirror_bufs = false;
+
 Client::Client(std::string const &tag, int color, int rsz, int wsz, Key key,
                bool line_buffering, unsigned line_buffering_ms,
                L4::Ipc_svr::Server_iface *sif, Controller *ctl)
 : _col(color), _tag(tag), _line_buffering(line_buffering),
-  _line_buffering_ms(line_buffering_ms), _key(key), _wb(wsz), _rb(rsz),
-  _first_unwritten(_wb.head()), _timeout(this), _sif(sif), _ctl(ctl)
+  _line_buffering_ms(line_buffering_ms), _key(key),
+  _wb(wsz, _mirror_bufs), _rb(rsz, _mirror_bufs),
+  _first_unwritten(_wb.head()), _stamps(_wb.capacity()), _timeout(this),
+  _sif(sif), _ctl(ctl)
 {
   _attr.i_flags = L4_VCON_ICRNL;
   _attr.o_flags = L4_VCON_ONLRET | L4_VCON_ONLCR;
   _attr.l_flags = L4_VCON_ECHO;
+  select_ingest();
 }
 
 Client::~Client()
 {
+  compressed_history(0);
+
   if (output_mux())
     output_mux()->disconnect(this);
 
@@ -41,6 +50,17 @@ Client::~Client()
     _ctl->remove_client(this);
 }
 
+void
+Client::compressed_history(unsigned long budget)
+{
+  _wb.evict_sink(nullptr);
+  delete _cold;
+  _cold = budget ? new Cold_history(budget, _wb.tail_pos()) : nullptr;
+  _wb.evict_sink(_cold);
+  // Compressed lines beyond this many lose their stamps, oldest first.
+  _stamps.limit(_wb.capacity() + budget);
+}
+
 bool
 Client::collected()
 {
@@ -51,19 +71,34 @@ Client::collected()
   return true;
 }
 
-static constexpr int Max_timestamp_len = 25;
-
 void
-Client::print_timestamp()
+Client::stamp_line()
 {
-  time_t t = time(NULL);
-  struct tm *tt = localtime(&t);
-  char b[Max_timestamp_len];
-
-  int l = tt ? strftime(b, sizeof(b), "[%Y-%m-%d %T] ", tt)
-             : snprintf(b, sizeof(b), "[unknown] ");
-  if (l)
-    wbuf()->put(b, l);
+  unsigned long pos = wbuf()->head_pos();
+  if (!_stamps.empty() && _stamps.back().pos == pos)
+    return;
+
+  // Forget the stamps of lines that dropped out of the history.
+  unsigned long start = History(this).start();
+  while (!_stamps.empty() && long(_stamps.front().pos - start) < 0)
+    _stamps.pop_front();
+
+  _stamps.push_back(Line_stamp{pos, Timestamp::now()});
+}
+
+unsigned
+Client::find_stamp(unsigned long pos) const
+{
+  unsigned lo = 0, hi = _stamps.size();
+  while (lo < hi)
+    {
+      unsigned m = (lo + hi) / 2;
+      if (long(_stamps[m].pos - pos) < 0)
+        lo = m + 1;
+      else
+        hi = m;
+    }
+  return lo;
 }
 
 void
@@ -72,22 +107,40 @@ Client::do_output(Buf::Index until)
   if (!_output)
     return;
 
-  wbuf()->write(_first_unwritten, until, this);
-  _first_unwritten = until;
+  Buf const *w = wbuf();
+  unsigned long pos = w->head_pos() - w->distance(_first_unwritten, w->head());
+  unsigned si = find_stamp(pos);
+  while (_first_unwritten != until)
+    {
+      char const *d;
+      int l = w->span(_first_unwritten, until, &d);
+      write_stamped(pos, d, l, &si, this);
+      pos += l;
+      _first_unwritten = _first_unwritten + l;
+    }
 
   if (!(_attr.l_flags & L4_VCON_ICANON))
     _output->flush(this);
 }
 
+/**
+ * Store client output in the write buffer and forward it to the output.
+ *
+ * \tparam F  Ingest_flags the kernel is specialized for, so that the inner
+ *            loops do not have to test the attributes for every character.
+ */
+template<unsigned F>
 void
-Client::cooked_write(const char *buf, long size) throw()
+Client::ingest(const char *buf, long size)
 {
-  if (size < 0)
-    size = strlen(buf);
-
   Client::Buf *w = wbuf();
   Buf::Index last_nl = _first_unwritten;
 
+  // Without output translation and timestamps, input is stored verbatim.
+  bool const raw = !(F & (Ingest_onlcr | Ingest_ocrnl | Ingest_onlret
+                          | Ingest_timestamp));
+  bool const line_buffering = F & Ingest_line_buffering;
+
   while (size)
     {
       // If doing output, we must be careful not to overwrite parts of the
@@ -97,39 +150,74 @@ Client::cooked_write(const char *buf, long size) throw()
       long max_batch_size = _output
         // The range from the write buffer's head to the first unwritten
         // character can be safely written to. Adjust that distance for the
-        // possibility that we have to print a timestamp and write an
-        // additional \r character for \n.
-        ? w->distance(w->head(), _first_unwritten - 1) - Max_timestamp_len - 1
+        // possibility that we have to write an additional \r character for
+        // \n.
+        ? w->distance(w->head(), _first_unwritten - 1) - !raw
         // Not doing output, so no need to limit the maximum batch size.
         : LONG_MAX;
 
       long batch_size = 0;
-      for (; batch_size < size && batch_size < max_batch_size; batch_size++)
+      if (raw)
         {
-          if (_new_line && timestamp())
+          batch_size = cxx::min(size, max_batch_size);
+          if (batch_size > 0)
             {
-              print_timestamp();
-              max_batch_size -= Max_timestamp_len;
+              w->put(buf, batch_size);
+
+              if (line_buffering && _output)
+                {
+                  char const *nl = 0;
+                  for (char const *p = buf, *e = buf + batch_size;
+                       (p = static_cast<char const *>(memchr(p, '\n', e - p)));
+                       ++p)
+                    nl = p;
+
+                  if (nl)
+                    last_nl = w->head() - (buf + batch_size - nl - 1);
+                }
+
+              _new_line = buf[batch_size - 1] == '\n';
+              buf += batch_size;
+            }
+        }
+
+      while (!raw && batch_size < size && batch_size < max_batch_size)
+        {
+          if ((F & Ingest_timestamp) && _new_line)
+            stamp_line();
+
+          // Characters other than \n and \r are stored unchanged, copy
+          // them in bulk.
+          long n = cxx::min(size, max_batch_size) - batch_size;
+          long run = find_eol(buf, buf + n) - buf;
+          if (run)
+            {
+              w->put(buf, run);
+              buf += run;
+              batch_size += run;
+              _new_line = false;
+              continue;
             }
 
           char c = *buf++;
+          batch_size++;
 
-          if (_attr.o_flags & L4_VCON_ONLCR && c == '\n')
+          if ((F & Ingest_onlcr) && c == '\n')
             {
               w->put('\r');
               max_batch_size--;
             }
 
-          if (_attr.o_flags & L4_VCON_OCRNL && c == '\r')
+          if ((F & Ingest_ocrnl) && c == '\r')
             c = '\n';
 
-          if (_attr.o_flags & L4_VCON_ONLRET && c == '\r')
+          if ((F & Ingest_onlret) && c == '\r')
             continue;
 
           w->put(c);
 
           _new_line = c == '\n';
-          if (_new_line)
+          if (line_buffering && _new_line)
             last_nl = w->head();
         }
 
@@ -141,7 +229,7 @@ Client::cooked_write(const char *buf, long size) throw()
           Buf::Index write_until = w->head();
           // If line buffering is enabled only print complete lines, except when an
           // incomplete line spans the entire write buffer.
-          if (_line_buffering && batch_size > 0)
+          if (line_buffering && batch_size > 0)
             write_until = last_nl;
 
           // Output characters processed up to and in this batch.
@@ -152,7 +240,7 @@ Client::cooked_write(const char *buf, long size) throw()
 
   // If line buffering is enabled, and there is an incomplete line pending in
   // the write buffer, enqueue the line buffer timeout.
-  if (_output && _line_buffering && w->head() != _first_unwritten && _sif)
+  if (line_buffering && _output && w->head() != _first_unwritten && _sif)
     {
       _sif->remove_timeout(&_timeout);
       _sif->add_timeout(&_timeout,
@@ -160,6 +248,42 @@ Client::cooked_write(const char *buf, long size) throw()
     }
 }
 
+template<unsigned... F>
+Client::Ingest
+Client::ingest_kernel(unsigned flags, std::integer_sequence<unsigned, F...>)
+{
+  static Ingest const kernels[] = { &Client::ingest<F>... };
+  return kernels[flags];
+}
+
+void
+Client::select_ingest()
+{
+  unsigned f = 0;
+  if (_attr.o_flags & L4_VCON_ONLCR)
+    f |= Ingest_onlcr;
+  if (_attr.o_flags & L4_VCON_OCRNL)
+    f |= Ingest_ocrnl;
+  if (_attr.o_flags & L4_VCON_ONLRET)
+    f |= Ingest_onlret;
+  if (_timestamp)
+    f |= Ingest_timestamp;
+  if (_line_buffering)
+    f |= Ingest_line_buffering;
+
+  _ingest = ingest_kernel(
+    f, std::make_integer_sequence<unsigned, Ingest_num_kernels>());
+}
+
+void
+Client::cooked_write(const char *buf, long size) throw()
+{
+  if (size < 0)
+    size = strlen(buf);
+
+  (this->*_ingest)(buf, size);
+}
+
 void
 Client::timeout_expired()
 {
@@ -8,17 +8,22 @@
 #pragma once
 
 #include <string>
+#include <utility>
 
 #include <l4/sys/vcon>
 #include <l4/sys/cxx/ipc_server_loop>
 #include <l4/cxx/ipc_timeout_queue>
+#include <l4/cxx/dlist>
 
+#include "cold_history.h"
 #include "output_mux.h"
+#include "ring_buf.h"
+#include "timestamp.h"
 
 #include <cstring>
 #include <l4/cxx/string>
 
-#include <vector>
+#include <l4/bid_config.h>
 
 class Controller;
 
@@ -36,7 +41,7 @@ private:
   Client *_client;
 };
 
-class Client
+class Client : public cxx::D_list_item
 {
 public:
   class Key
@@ -54,259 +59,31 @@ public:
     char _key;
   };
 
-  class Buf
-  {
-  public:
-    class Index
-    {
-    public:
-      bool operator == (Index v) const { return v.i == i; }
-      bool operator != (Index v) const { return v.i != i; }
-
-      Index operator ++ ()
-      {
-        if (++i == _b->_bufsz)
-          i = 0;
-        return *this;
-      }
-
-      Index operator ++ (int)
-      {
-        int n = i;
-        ++(*this);
-        return Index(n, _b);
-      }
-
-      Index operator -- ()
-      {
-        if (i == 0)
-          i = _b->_bufsz;
-        --i;
-        return *this;
-      }
-
-      Index operator + (int v)
-      {
-        int n = i + v;
-        if (n > _b->_bufsz || n < 0)
-          n %= _b->_bufsz;
-        return Index(n, _b);
-      }
-
-      Index operator - (int v)
-      {
-        return this->operator+(-v);
-      }
-
-    private:
-      friend class Buf;
-      explicit Index(int i, Buf const *b) : i(i), _b(b) {}
-      int i;
-      Buf const *_b;
-    };
-
-    explicit Buf(size_t sz)
-    : _buf(new char [sz + 1]), _bufsz(sz)
-    {
-      // allocate another byte and set it to zero to prevent accidental
-      // out-of-bound reads due to wrongfully using the byte array as C-string.
-      memset(_buf + sz, 0, 1);
-    }
-
-    Buf() = delete;
-    ~Buf() { delete [] _buf; }
-
-    Index head() const { return Index(_head, this); }
-    Index tail() const { return Index(_tail, this); }
-
-    char operator [] (Index const &i) const { return _buf[i.i]; }
-
-    /**
-     * Write buffer content to passed object.
-     *
-     * \tparam O  Type implementing the `write()` function.
-     *
-     * \param s  Start marker in this buffer.
-     * \param e  Exclusive end marker in this buffer.
-     * \param o  Object to write to.
-     */
-    template< typename O >
-    int write(Index const &s, Index const &e, O *o) const
-    {
-      int l = 0;
-      if (s.i < e.i)
-        l += o->write(_buf + s.i, e.i - s.i);
-      else if (s.i > e.i)
-        {
-          l += o->write(_buf + s.i, _bufsz - s.i);
-          l += o->write(_buf, e.i);
-        }
-      return l;
-    }
-
-    /**
-     * Place a break signal at the current head.
-     *
-     * Logically speaking, this adds content to the buffer and if the buffer
-     * was empty before, the client must be notified of the new data to read.
-     *
-     * \return True, iff the client needs to be notified.
-     */
-    bool put_break()
-    {
-      if (break_points.empty() || break_points.back() != _head)
-        break_points.push_back(_head);
-
-      return empty();
-    }
-
-    /**
-     * Check if the next break signal is at the given offset from tail.
-     *
-     * \param offset  Byte offset from tail.
-     *
-     * \retval True, iff the next break signal is registered there.
-     */
-    bool is_next_break(int offset) const
-    {
-      return    !break_points.empty()
-             && ((_tail + offset) % _bufsz) == break_points[0];
-    }
-
-    /// Clear the next break signal in the queue.
-    void clear_next_break()
-    {
-      break_points.erase(break_points.begin());
-    }
-
-    /// Clear an old break signal located under the new _head marker.
-    void clear_break_on_overwrite()
-    {
-      if (!break_points.empty() && break_points[0] == _head)
-        clear_next_break();
-    }
-
-    bool put(char d)
-    {
-      bool was_empty = empty();
-      ++_sum_bytes;
-
-      if (d == '\n')
-        ++_sum_lines;
-
-      _buf[_head] = d;
-
-      if (++_head == _bufsz)
-        _head = 0;
-
-      clear_break_on_overwrite();
-
-      if (_head == _tail && ++_tail == _bufsz)
-        _tail = 0;
-
-      return was_empty;
-    }
+#ifdef CONFIG_CONS_EXACT_BUFFER_SIZE
+  typedef Ring_buf<Ring_wrap_mod> Buf;
+#else
+  typedef Ring_buf<Ring_wrap_mask> Buf;
+#endif
 
-    bool put(const char *d, int len)
-    {
-      bool was_empty = empty();
-      _sum_bytes += len;
-      while (len--)
-        {
-          if ((_head + 1) % _bufsz == _tail)
-            _tail = (_tail + 1) % _bufsz;
-
-          if (*d == '\n')
-            _sum_lines++;
-
-          _buf[_head++] = *d++;
-          if(_head == _bufsz)
-            _head = 0;
-
-          clear_break_on_overwrite();
-        }
-      return was_empty;
-    }
-
-    /**
-     * Return the longest continuous number of bytes in the buffer. This is not
-     * a C-style string.
-     *
-     * \param      offset  Offset from current start of the buffer.
-     * \param[out] d       Character array without terminating NULL character.
-     *
-     * When the buffer wrapped around, the returned array ends at the end of
-     * the buffer.
-     *
-     * \retval Array length.
-     */
-    int get(int offset, char const **d) const
-    {
-      if (offset < 0 || (unsigned)offset >= _sum_bytes)
-        return 0;
-
-      offset = (_tail + offset) % _bufsz;
-      *d = &_buf[offset];
-
-      if (offset > _head)
-        return _bufsz - offset;
-      return _head - offset;
-    }
-
-    Index find_backwards(char v, Index p) const
-    {
-      while (p != tail())
-        {
-          --p;
-          if ((*this)[p] == v)
-            return p;
-        }
-
-      return p;
-    }
-
-    Index find_forwards(char v, Index p) const
-    {
-      while (p != head())
-        {
-          if ((*this)[p] == v)
-            return p;
-          ++p;
-        }
-
-      return p;
-    }
-
-    bool empty() const { return head() == tail(); }
-
-    int distance() const { return distance(tail(), head()); }
-
-    int distance(Index start, Index end) const
-    {
-      if (end.i >= start.i)
-        return end.i - start.i;
-      return (end.i + _bufsz) - start.i;
-    }
-
-    void clear(int l)
-    {
-      if (distance() >= _bufsz)
-        _tail = _head;
-      else
-        _tail = (_tail + l) % _bufsz;
-    }
-
-    unsigned long stat_bytes() const { return _sum_bytes; }
-    unsigned long stat_lines() const { return _sum_lines; }
+  /// Arrival time of a line in the output history.
+  struct Line_stamp
+  {
+    unsigned long pos;
+    l4_cpu_time_t time;
+  };
 
-  private:
-    Buf(Buf const &) = delete;
-    Buf &operator = (Buf const &) = delete;
-    char *_buf;
-    int _bufsz;
-    int _head = 0, _tail = 0;
-    std::vector<int> break_points;
-    unsigned long _sum_bytes = 0, _sum_lines = 0;
+  /**
+   * Start of the tagged output lines of this client, as rendered by the
+   * output mux.
+   */
+  struct Line_prefix
+  {
+    /// Tag length the prefix was rendered for, 0 if not rendered yet.
+    unsigned tag_len = 0;
+    /// Length of the color escape sequence at the start of `s`.
+    unsigned color_len = 0;
+    /// Color escape sequence followed by the padded tag.
+    std::string s;
   };
 
   void timeout_expired();
@@ -362,7 +139,7 @@ public:
   bool timestamp() const { return _timestamp; }
 
   void keep(bool keep) { _keep = keep; }
-  void timestamp(bool ts) { _timestamp = ts; }
+  void timestamp(bool ts) { _timestamp = ts; select_ingest(); }
 
   void output_mux(Output_mux *m) { _output = m; }
   Output_mux *output_mux() const { return _output; }
@@ -374,12 +151,79 @@ public:
   bool output_line_preempted() const { return _p; }
   void preempt_output_line() { _p = true; }
   void output_line_done() { _p = false; }
+  Line_prefix *line_prefix() { return &_line_prefix; }
 
   Buf *rbuf() { return &_rb; }
   Buf const *rbuf() const { return &_rb; }
   Buf *wbuf() { return &_wb; }
   Buf const *wbuf() const { return &_wb; }
 
+  /**
+   * Keep output dropping out of the write buffer in compressed form.
+   *
+   * \param budget  Maximum size of the compressed history in bytes, 0
+   *                disables (and discards) the compressed history.
+   */
+  void compressed_history(unsigned long budget);
+  Cold_history const *compressed_history() const { return _cold; }
+
+  /// Index of the first line stamp at or behind absolute position `pos`.
+  unsigned find_stamp(unsigned long pos) const;
+
+  /**
+   * Get the arrival time of a line.
+   *
+   * \param      pos   Absolute start position of the line.
+   * \param[out] time  KIP clock value when the line arrived.
+   *
+   * \return True if the line was stamped.
+   */
+  bool line_stamp(unsigned long pos, l4_cpu_time_t *time) const
+  {
+    unsigned i = find_stamp(pos);
+    if (i == _stamps.size() || _stamps[i].pos != pos)
+      return false;
+
+    *time = _stamps[i].time;
+    return true;
+  }
+
+  /**
+   * Write a run of output, rendering the timestamps of the lines starting
+   * in it.
+   *
+   * \tparam O  Type implementing the `write()` function.
+   *
+   * \param         pos  Absolute position of the run in the output history.
+   * \param         d    Start of the run.
+   * \param         len  Length of the run.
+   * \param[in,out] si   Index of the next line stamp, see find_stamp().
+   * \param         o    Object to write to.
+   */
+  template<typename O>
+  void write_stamped(unsigned long pos, char const *d, unsigned len,
+                     unsigned *si, O *o) const
+  {
+    for (; *si < _stamps.size(); ++*si)
+      {
+        Line_stamp const &s = _stamps[*si];
+        unsigned off = s.pos - pos;
+        if (off >= len)
+          break;
+
+        char b[Timestamp::Max_len];
+        if (off)
+          o->write(d, off);
+        o->write(b, Timestamp::format(s.time, b));
+        pos += off;
+        d += off;
+        len -= off;
+      }
+
+    if (len)
+      o->write(d, len);
+  }
+
   l4_vcon_attr_t const *attr() const { return &_attr; }
 
   virtual void trigger() const = 0;
@@ -395,12 +239,19 @@ public:
   void skip_unwritten()
   { _first_unwritten = wbuf()->head(); }
 
+  /// Back the buffers of subsequently created clients with mirrored memory.
+  static void mirror_buffers(bool mirror) { _mirror_bufs = mirror; }
+
   int idx = 0;
 
+  /// Neighbours among the clients with the same tag, kept by the Controller.
+  Client *tag_prev = nullptr, *tag_next = nullptr;
+
 private:
   int _col;
   std::string _tag;
   bool _p = false;
+  Line_prefix _line_prefix;
   bool _keep = false;
   bool _timestamp = false;
   bool _new_line = true;
@@ -409,11 +260,16 @@ private:
   unsigned _line_buffering_ms = 50;
   Key _key;
 
+  static bool _mirror_bufs;
+
   Buf _wb, _rb;
+  Cold_history *_cold = nullptr;
 
   Buf::Index _first_unwritten;
 
-  void print_timestamp();
+  Fifo_ring<Line_stamp> _stamps;
+
+  void stamp_line();
   void do_output(Buf::Index until);
 
   Client_timeout<Client> _timeout;
@@ -421,8 +277,39 @@ private:
 
   Controller *_ctl;
 
+  /// Properties an ingest kernel is specialized for.
+  enum Ingest_flags
+  {
+    Ingest_onlcr          = 1,
+    Ingest_ocrnl          = 2,
+    Ingest_onlret         = 4,
+    Ingest_timestamp      = 8,
+    Ingest_line_buffering = 16,
+    Ingest_num_kernels    = 32,
+  };
+
+  typedef void (Client::*Ingest)(char const *, long);
+
+  /// Kernel of cooked_write() matching the current attributes.
+  Ingest _ingest;
+
+  template<unsigned F>
+  void ingest(char const *buf, long size);
+
+  template<unsigned... F>
+  static Ingest ingest_kernel(unsigned flags,
+                              std::integer_sequence<unsigned, F...>);
+
+  void select_ingest();
+
 protected:
   l4_vcon_attr_t _attr;
 
+  /// Must be called after modifying `_attr`.
+  void attr_changed() { select_ingest(); }
+
+  /// Server loop the client's timeouts are queued in, may be nullptr.
+  L4::Ipc_svr::Server_iface *sif() const { return _sif; }
+
   Output_mux *_output = nullptr;
 };
@@ -0,0 +1,187 @@
+/*
+ * Copyright (C) 2026 Kernkonzept GmbH.
+ *
+ * License: see LICENSE.spdx (in this directory or the directories above)
+ */
+#include "cold_history.h"
+#include "lz.h"
+
+#include <l4/cxx/minmax>
+
+#include <cstring>
+
+void
+Cold_history::evict(char const *d, unsigned len)
+{
+  while (len)
+    {
+      unsigned l = cxx::min<unsigned>(len, Block_size - _staged);
+      memcpy(_stage + _staged, d, l);
+      _staged += l;
+      _end += l;
+      d += l;
+      len -= l;
+
+      if (_staged == Block_size)
+        seal();
+    }
+}
+
+void
+Cold_history::seal()
+{
+  static char tmp[Lz::bound(Block_size)];
+
+  Segment s;
+  s.pos = _end - _staged;
+  s.len = _staged;
+  s.newlines = 0;
+  for (char const *p = _stage, *e = _stage + _staged;
+       (p = static_cast<char const *>(memchr(p, '\n', e - p))); ++p)
+    ++s.newlines;
+
+  unsigned cl = Lz::compress(_stage, _staged, tmp, sizeof(tmp));
+  s.raw = !cl || cl >= _staged;
+  if (s.raw)
+    s.data.assign(_stage, _stage + _staged);
+  else
+    s.data.assign(tmp, tmp + cl);
+
+  _used += s.data.size();
+  _segs.push_back(std::move(s));
+  _staged = 0;
+
+  while (_used > _budget && !_segs.empty())
+    {
+      _used -= _segs.front().data.size();
+      _segs.pop_front();
+    }
+}
+
+/// Get the number of the block containing the absolute position `pos`.
+unsigned
+Cold_history::find_block(unsigned long pos) const
+{
+  unsigned lo = 0, hi = _segs.size();
+  while (lo < hi)
+    {
+      unsigned m = (lo + hi) / 2;
+      if (long(pos - (_segs[m].pos + _segs[m].len)) < 0)
+        hi = m;
+      else
+        lo = m + 1;
+    }
+  return lo;
+}
+
+/**
+ * Get the uncompressed content of a block.
+ *
+ * \param      i    Block number, the staging block comes last.
+ * \param[out] d    Start of the content.
+ * \param      buf  Buffer of Block_size bytes to decompress into.
+ *
+ * \return Length of the content.
+ */
+unsigned
+Cold_history::block(unsigned i, char const **d, char *buf) const
+{
+  if (i == _segs.size())
+    {
+      *d = _stage;
+      return _staged;
+    }
+
+  Segment const &s = _segs[i];
+  if (s.raw)
+    {
+      *d = s.data.data();
+      return s.len;
+    }
+
+  *d = buf;
+  int l = Lz::decompress(s.data.data(), s.data.size(), buf, Block_size);
+  if (l != (int)s.len)
+    {
+      // Cannot happen for data we compressed ourselves.
+      memset(buf, '?', s.len);
+      return s.len;
+    }
+  return l;
+}
+
+bool
+Cold_history::rfind_newline(unsigned long limit, unsigned n,
+                            unsigned long *pos) const
+{
+  char buf[Block_size];
+
+  if (!n || empty() || long(limit - begin()) <= 0)
+    return false;
+
+  if (long(limit - _end) > 0)
+    limit = _end;
+
+  for (unsigned i = find_block(limit - 1) + 1; i-- > 0;)
+    {
+      unsigned long bp = block_pos(i);
+      unsigned len = limit - bp;
+
+      // Sealed blocks entirely before `limit` know their newline count.
+      if (i < _segs.size() && len >= _segs[i].len)
+        {
+          if (_segs[i].newlines < n)
+            {
+              n -= _segs[i].newlines;
+              limit = bp;
+              continue;
+            }
+          len = _segs[i].len;
+        }
+
+      char const *d;
+      block(i, &d, buf);
+      for (char const *p = d + len; p != d;)
+        if (*--p == '\n' && !--n)
+          {
+            *pos = bp + (p - d);
+            return true;
+          }
+
+      limit = bp;
+    }
+
+  return false;
+}
+
+Cold_history::Reader::Reader(Cold_history const *h, unsigned long from,
+                             unsigned long to)
+: _h(h), _blk(0), _pos(from), _to(to)
+{
+  if (!h)
+    {
+      _to = _pos;
+      return;
+    }
+
+  if (long(_pos - h->begin()) < 0)
+    _pos = h->begin();
+  if (long(_to - h->end()) > 0)
+    _to = h->end();
+
+  _blk = h->find_block(_pos);
+}
+
+unsigned
+Cold_history::Reader::next(char const **d)
+{
+  if (long(_to - _pos) <= 0 || _blk >= _h->blocks())
+    return 0;
+
+  unsigned off = _pos - _h->block_pos(_blk);
+  unsigned len = _h->block(_blk++, d, _buf);
+  *d += off;
+  len = cxx::min<unsigned long>(len - off, _to - _pos);
+  _pos += len;
+  return len;
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2026 Kernkonzept GmbH.
+ *
+ * License: see LICENSE.spdx (in this directory or the directories above)
+ */
+#pragma once
+
+#include "ring_buf.h"
+
+#include <deque>
+#include <vector>
+
+/**
+ * Compressed history of client output that dropped out of the write buffer.
+ *
+ * Evicted bytes are collected in a staging block and compressed with the Lz
+ * codec once the block is full. The oldest compressed blocks are discarded
+ * when their total size exceeds the configured budget.
+ *
+ * Like Ring_buf, content is addressed by absolute positions.
+ */
+class Cold_history final : public Ring_evict_sink
+{
+public:
+  enum { Block_size = 4096 };
+
+  /**
+   * Create an empty history.
+   *
+   * \param budget  Maximum size of the compressed blocks in bytes.
+   * \param pos     Absolute position of the first byte to be evicted.
+   */
+  Cold_history(unsigned long budget, unsigned long pos)
+  : _end(pos), _budget(budget)
+  {}
+
+  void evict(char const *d, unsigned len) override;
+
+  /// Absolute position of the oldest byte.
+  unsigned long begin() const
+  { return _segs.empty() ? _end - _staged : _segs.front().pos; }
+
+  /// Absolute position behind the newest byte.
+  unsigned long end() const { return _end; }
+
+  bool empty() const { return begin() == _end; }
+
+  /// Size of the compressed blocks in bytes.
+  unsigned long used() const { return _used; }
+  unsigned long budget() const { return _budget; }
+
+  /**
+   * Find a newline character searching backwards.
+   *
+   * \param      limit  Absolute position to start searching at (exclusive).
+   * \param      n      Find the `n`th newline character before `limit`.
+   * \param[out] pos    Absolute position of the newline character.
+   *
+   * \return True if the newline character was found.
+   */
+  bool rfind_newline(unsigned long limit, unsigned n,
+                     unsigned long *pos) const;
+
+  /**
+   * Sequential reader decompressing a range of the history block by block.
+   */
+  class Reader
+  {
+  public:
+    /**
+     * \param h     History to read, may be null for an empty range.
+     * \param from  Absolute start position, clamped to the oldest byte.
+     * \param to    Absolute end position (exclusive).
+     */
+    Reader(Cold_history const *h, unsigned long from, unsigned long to);
+
+    /**
+     * Get the next run of bytes.
+     *
+     * \param[out] d  Start of the run, valid until the next call.
+     *
+     * \return Length of the run, 0 at the end of the range.
+     */
+    unsigned next(char const **d);
+
+  private:
+    Cold_history const *_h;
+    unsigned _blk;
+    unsigned long _pos, _to;
+    char _buf[Block_size];
+  };
+
+private:
+  struct Segment
+  {
+    unsigned long pos;
+    unsigned len;
+    unsigned newlines;
+    bool raw;
+    std::vector<char> data;
+  };
+
+  unsigned blocks() const { return _segs.size() + 1; }
+  unsigned long block_pos(unsigned i) const
+  { return i < _segs.size() ? _segs[i].pos : _end - _staged; }
+  unsigned find_block(unsigned long pos) const;
+  unsigned block(unsigned i, char const **d, char *buf) const;
+  void seal();
+
+  std::deque<Segment> _segs;
+  char _stage[Block_size];
+  unsigned _staged = 0;
+  unsigned long _end;
+  unsigned long _budget;
+  unsigned long _used = 0;
+};
@@ -10,9 +10,15 @@
 
 #include "controller.h"
 #include <algorithm>
+#include <cctype>
+#include <deque>
+#include <string>
 #include <vector>
 
 #include "globmatch.h"
+#include "grep.h"
+#include "history.h"
+#include "scan.h"
 
 Controller::Cmd Controller::_cmds[] =
     {
@@ -57,11 +63,128 @@ private:
   Controller::Cmd const *_cmd;
 };
 
+/**
+ * Read the lines of a client's output history one after another.
+ *
+ * A line ends at a newline character, the last line at the end of the
+ * history. A newline character at the very end terminates the last line.
+ */
+class Line_reader
+{
+public:
+  explicit Line_reader(History const &h)
+  : _r(h, h.start()), _next(h.start())
+  {}
+
+  /// Absolute position of the line returned last.
+  unsigned long pos() const { return _pos; }
+
+  /**
+   * Get the next line without its newline character.
+   *
+   * \param[out] d           Contiguous content of the line. Only valid
+   *                          until the next call.
+   * \param[out] len         Length of the line.
+   * \param[out] terminated  True if the line ends with a newline character.
+   *
+   * \return False if there are no more lines.
+   */
+  bool next(char const **d, int *len, bool *terminated)
+  {
+    bool carried = false;
+    _carry.clear();
+    _pos = _next;
+
+    for (;;)
+      {
+        if (!_left && !(_left = _r.next(&_p)))
+          {
+            // End of the history, return an unterminated last line.
+            *d = _carry.data();
+            *len = _carry.size();
+            *terminated = false;
+            return carried;
+          }
+
+        char const *nl = static_cast<char const *>(memchr(_p, '\n', _left));
+        if (!nl)
+          {
+            // The line continues in the next run.
+            _carry.append(_p, _left);
+            carried = true;
+            _left = 0;
+            continue;
+          }
+
+        int l = nl - _p;
+        if (carried)
+          {
+            _carry.append(_p, l);
+            *d = _carry.data();
+            *len = _carry.size();
+          }
+        else
+          {
+            *d = _p;
+            *len = l;
+          }
+
+        *terminated = true;
+        _next += *len + 1;
+        _p = nl + 1;
+        _left -= l + 1;
+        return true;
+      }
+  }
+
+  /**
+   * Skip the lines before the next line that may contain a pattern.
+   *
+   * Only complete lines of the current contiguous run of the history are
+   * skipped, the pattern is searched in the run as a whole.
+   *
+   * \param m     Pattern to search for.
+   * \param keep  Number of lines before the line containing the pattern
+   *              that shall not be skipped.
+   *
+   * \return Number of lines skipped.
+   */
+  unsigned skip(Grep_matcher const &m, unsigned keep)
+  {
+    if (!_left)
+      return 0;
+
+    char const *end = m.find(_p, _p + _left);
+    for (unsigned i = 0; i <= keep; ++i)
+      {
+        end = static_cast<char const *>(memrchr(_p, '\n', end - _p));
+        if (!end)
+          return 0;
+      }
+
+    ++end;
+    unsigned l = end - _p;
+    unsigned n = count_nl(_p, end);
+    _next += l;
+    _p = end;
+    _left -= l;
+    return n;
+  }
+
+private:
+  History::Reader _r;
+  unsigned long _pos, _next;
+  char const *_p = nullptr;
+  unsigned _left = 0;
+  std::string _carry;
+};
+
 class Client_name_iter : public String_set_iter
 {
 public:
-  explicit Client_name_iter(Controller::Client_list const *c)
-  : _client(c->begin()), _e(c->end())
+  Client_name_iter(Controller::Client_index_iter b,
+                   Controller::Client_index_iter e)
+  : _client(b), _e(e)
   {}
 
   cxx::String value(cxx::String buf) const override
@@ -81,21 +204,175 @@ public:
   { return _client != _e; }
 
 private:
-  Controller::Client_const_iter _client, _e;
+  Controller::Client_index_iter _client, _e;
 };
+
+/**
+ * Get the part of a completion argument any tag starting with it has to
+ * start with.
+ *
+ * A completion also matches "tag:idx" names, so the argument may extend
+ * beyond the tag after a colon.
+ */
+std::string
+completion_prefix(cxx::String const &arg)
+{
+  cxx::String::Index c = arg.find_match([](char c) { return c == ':'; });
+  return std::string(arg.start(), c - arg.start());
+}
+
+/**
+ * Get the literal part of a glob pattern before its first wildcard.
+ */
+std::string
+glob_prefix(std::string const &pattern)
+{
+  return pattern.substr(0, pattern.find_first_of("*."));
+}
+}
+
+/**
+ * Add a client to the client list and the lookup indexes.
+ *
+ * If the tag of the client is already in use, the client gets the next
+ * index for this tag.
+ */
+void
+Controller::add_client(Client_ptr client)
+{
+  auto i = _tags.emplace(client->tag(), Tag_clients());
+  Tag_clients &t = i.first->second;
+  if (i.second)
+    {
+      t.tag = &i.first->first;
+      _sorted.insert(&t);
+    }
+
+  client->tag_prev = t.last;
+  client->tag_next = nullptr;
+  if (t.last)
+    {
+      client->idx = t.last->idx + 1;
+      t.last->tag_next = client;
+    }
+  else
+    t.first = client;
+  t.last = client;
+  t.by_idx[client->idx] = client;
+
+  clients.push_back(client);
+
+  Client::Key k = client->key();
+  if (!k.is_nil() && !find_client(k))
+    _keys[static_cast<unsigned char>(k.v())] = client;
 }
 
 void
 Controller::remove_client(Client_ptr client)
 {
-  for (auto it = clients.begin(); it != clients.end(); ++it)
-    if (client == *it)
+  // Clients that failed to register were never added.
+  auto i = _tags.find(client->tag());
+  if (i == _tags.end())
+    return;
+
+  Tag_clients &t = i->second;
+  auto c = t.by_idx.find(client->idx);
+  if (c == t.by_idx.end() || c->second != client)
+    return;
+
+  t.by_idx.erase(c);
+  (client->tag_prev ? client->tag_prev->tag_next : t.first) = client->tag_next;
+  (client->tag_next ? client->tag_next->tag_prev : t.last) = client->tag_prev;
+  client->tag_prev = client->tag_next = nullptr;
+
+  if (!t.first)
+    {
+      _sorted.erase(&t);
+      _tags.erase(i);
+    }
+
+  clients.remove(client);
+
+  if (find_client(client->key()) == client)
+    update_key(client->key());
+}
+
+/**
+ * Get the end of the clients whose tag starts with `prefix`.
+ */
+Controller::Client_index_iter
+Controller::prefix_end(std::string const &prefix) const
+{
+  // The smallest string greater than all strings starting with `prefix`.
+  std::string next = prefix;
+  while (!next.empty() && static_cast<unsigned char>(next.back()) == 0xff)
+    next.pop_back();
+
+  if (next.empty())
+    return sorted_end();
+
+  ++next.back();
+  return Client_index_iter(_sorted.lower_bound(next), _sorted.end());
+}
+
+/**
+ * Change the key of a client, keeping the key table in sync.
+ */
+void
+Controller::client_key(Client_ptr client, Client::Key key)
+{
+  Client::Key old = client->key();
+  client->key(key);
+  if (!old.is_nil())
+    update_key(old);
+  if (!key.is_nil())
+    update_key(key);
+}
+
+/**
+ * Find the first client using `key` after the set of clients using it
+ * changed. Keys rarely change, so a scan is fine here.
+ */
+void
+Controller::update_key(Client::Key key)
+{
+  Client_ptr &k = _keys[static_cast<unsigned char>(key.v())];
+  k = 0;
+  for (auto const c : clients)
+    if (c->key() == key)
       {
-        clients.erase(it);
+        k = c;
         break;
       }
 }
 
+/**
+ * Find a client by name, either "tag" for the first client with a tag or
+ * "tag:idx" for a specific one.
+ */
+Controller::Client_ptr
+Controller::find_client(cxx::String const &name) const
+{
+  auto t = _tags.find(std::string(name.start(), name.len()));
+  if (t != _tags.end() && t->second.first->idx == 0)
+    return t->second.first;
+
+  cxx::String::Index r = name.rfind(":");
+  if (name.eof(r))
+    return 0;
+
+  cxx::String tag = name.head(r);
+  t = _tags.find(std::string(tag.start(), tag.len()));
+  if (t == _tags.end())
+    return 0;
+
+  int idx = 0;
+  name.substr(r + 1).from_dec(&idx);
+
+  auto c = t->second.by_idx.find(idx);
+  return c != t->second.by_idx.end() ? c->second : 0;
+}
+
 Client *
 Controller::get_client(Mux *mux, int argc, int idx, Arg *a)
 {
@@ -106,10 +383,8 @@ Controller::get_client(Mux *mux, int argc, int idx, Arg *a)
       return 0;
     }
 
-  Client_iter c = std::find_if(clients.begin(), Client_iter(clients.end()),
-                               Client::Equal_tag_idx(a[idx].a));
-  if (c != clients.end())
-    return *c;
+  if (Client *c = find_client(a[idx].a))
+    return c;
 
   mux->printf("%.*s: console '%.*s' not found\n",
               a[0].a.len(), a[0].a.start(), a[idx].a.len(), a[idx].a.start());
@@ -255,6 +530,7 @@ int
 Controller::cmd_info(Mux *mux, int, Arg *)
 {
   mux->printf("Cons -- Vcon multiplexer\n");
+  mux->frontend_info();
   return 0;
 }
 
@@ -307,25 +583,17 @@ Controller::cmd_list(Mux *mux, int argc, Arg *args)
         patterns.push_back(std::string(args[i].a.start(), args[i].a.len()));
     }
 
-  auto sorted = clients;
-  std::sort(sorted.begin(), sorted.end(),
-            [](const Client_ptr a, const Client_ptr b) {
-              return a->tag().compare(b->tag()) < 0;
-            } );
-
   Client_list output_list;
   if (patterns.empty())
-    output_list = sorted;
+    for (auto c = sorted_begin(), e = sorted_end(); c != e; ++c)
+      output_list.push_back(*c);
   else
-    for (auto p : patterns)
+    for (auto const &p : patterns)
       {
-        Client_list plist;
-        for (auto const c : sorted)
-          if (glob::match(c->tag(), p))
-            plist.push_back(c);
-
-        for (auto const q : plist)
-          output_list.push_back(q);
+        std::string prefix = glob_prefix(p);
+        for (auto c = prefix_begin(prefix), e = prefix_end(prefix); c != e; ++c)
+          if (glob::match((*c)->tag(), p))
+            output_list.push_back(*c);
       }
 
   for (auto const i : output_list)
@@ -359,13 +627,8 @@ Controller::complete_console_name(Mux *mux, unsigned, unsigned argnr, Arg *arg,
   if (argnr != num_arg)
     return 0;
 
-  auto sorted = clients;
-  std::sort(sorted.begin(), sorted.end(),
-            [](const Client_ptr a, const Client_ptr b) {
-              return a->tag().compare(b->tag()) < 0;
-            } );
-
-  Client_name_iter i(&sorted);
+  std::string prefix = completion_prefix(arg[argnr].a);
+  Client_name_iter i(prefix_begin(prefix), prefix_end(prefix));
   return complete(mux, arg[argnr].a, &i, completed_arg);
 }
 
@@ -544,7 +807,7 @@ int Controller::cmd_key(Mux *mux, int argc, Arg *a)
     }
 
   if (Client *v = get_client(mux, argc, 1, a))
-    v->key(Client::Key(a[2].a[0]));
+    client_key(v, Client::Key(a[2].a[0]));
 
   return 0;
 }
@@ -583,12 +846,8 @@ Controller::complete_console_name_grep(Mux *mux, unsigned, unsigned argnr,
 
       if (++cnt == 2)
         {
-          auto sorted = clients;
-          std::sort(sorted.begin(), sorted.end(),
-                    [](const Client_ptr a, const Client_ptr b) {
-                      return a->tag().compare(b->tag()) < 0;
-                    } );
-          Client_name_iter cl(&clients);
+          std::string prefix = completion_prefix(arg[i].a);
+          Client_name_iter cl(prefix_begin(prefix), prefix_end(prefix));
           return complete(mux, arg[i].a, &cl, completed_arg);
         }
     }
@@ -607,6 +866,7 @@ Controller::cmd_grep(Mux *mux, int argc, Arg *a)
   bool opt_igncase   = false;
   bool opt_count     = false;
   bool opt_inv       = false;
+  bool opt_regex     = false;
   unsigned opt_ctx_b = 0;
   unsigned opt_ctx_a = 0;
 
@@ -623,6 +883,7 @@ Controller::cmd_grep(Mux *mux, int argc, Arg *a)
                 case 'i': opt_igncase = true; break;
                 case 'c': opt_count   = true; break;
                 case 'v': opt_inv     = true; break;
+                case 'E': opt_regex   = true; break;
                 case 'A':
                 case 'B':
                 case 'C':
@@ -658,119 +919,123 @@ Controller::cmd_grep(Mux *mux, int argc, Arg *a)
       // we should support multiple clients here
     }
 
-  if (opt_igncase)
-    for (int i = 0; i < pattern.len(); ++i)
-      const_cast<char &>(pattern[i]) = tolower(pattern[i]);
+  Grep_pattern const fixed(pattern, opt_igncase, opt_word);
+  Grep_matcher const *pat = &fixed;
+  if (opt_regex)
+    {
+      char const *err;
+      pat = Grep_regex::get(pattern, opt_igncase, opt_word, &err);
+      if (!pat)
+        {
+          mux->printf("grep: %s\n", err);
+          return 1;
+        }
+    }
 
   for (auto const v : clients)
     {
       if (given_client && &*v != given_client)
         continue;
 
-      Client::Buf const *b = v->wbuf();
-      Client::Buf::Index end = b->head();
+      History h(v);
+      Line_reader lines(h);
+      unsigned count = 0;
+      unsigned last_output_idx = ~0U;
+      unsigned print_until = 0;
+
+      // Lines not printed yet that may become preceding context.
+      struct Ctx_line
+      {
+        unsigned long pos;
+        std::string text;
+        bool terminated;
+      };
+      std::deque<Ctx_line> before;
 
-      enum { Flag_none = 0, Flag_print = 1 << 0, Flag_match = 1 << 1, };
-      typedef std::vector<Grep_lineinfo> Line_vector;
-      Line_vector lines;
+      // Tag and separator printed before each line of all clients.
+      std::string tag_sep = v->tag() + ':';
 
-      unsigned print_next_lines = 0;
-      Grep_lineinfo curline = Grep_lineinfo(b->tail());
-      bool is_match = false;
-      unsigned count = 0;
-      Client::Buf::Index i = b->tail();
-      bool exit_loop = false;
-      while (1)
+      auto print_line = [&](unsigned linenr, bool match, unsigned long pos,
+                            char const *d, int len, bool terminated)
         {
-          if (((*b)[i] == '\n' && i + 1 != end)
-              || i == end)
+          if (last_output_idx < linenr
+              && last_output_idx != linenr - 1
+              && (opt_ctx_a || opt_ctx_b))
+            mux->printf("--\n");
+
+          char sep = match ? ':' : '-';
+          if (!given_client)
             {
-              if (print_next_lines)
-                {
-                  curline.flags |= Flag_print;
-                  --print_next_lines;
-                }
+              tag_sep.back() = sep;
+              mux->print(tag_sep.data(), tag_sep.size());
+            }
 
-              if (opt_inv ^ !!is_match)
-                {
-                  ++count;
+          char b[16 + Timestamp::Max_len];
+          int n = 0;
+          if (opt_line)
+            n = snprintf(b, 16, "%u%c", linenr + 1, sep);
 
-                  curline.flags |= Flag_match | Flag_print;
+          l4_cpu_time_t t;
+          if (v->line_stamp(pos, &t))
+            n += Timestamp::format(t, b + n);
 
-                  unsigned o = cxx::min(lines.size(),
-                                        (Line_vector::size_type)opt_ctx_b);
+          if (n)
+            mux->print(b, n);
 
-                  for (; o; o--)
-                    lines[lines.size() - o].flags |= Flag_print;
+          // The line goes to the mux as a whole, straight from the history.
+          mux->print(d, len);
 
-                  if (opt_ctx_a > print_next_lines)
-                    print_next_lines = opt_ctx_a;
-                }
+          if (terminated)
+            mux->print("\n", 1);
 
-              lines.push_back(curline);
-              curline = Grep_lineinfo(i + 1);
-              is_match = false;
-            }
+          last_output_idx = linenr;
+        };
+
+      char const *d;
+      int len;
+      bool terminated;
+      for (unsigned linenr = 0;; ++linenr)
+        {
+          // Without -v, lines are only needed around a match.
+          if (!opt_inv && linenr >= print_until)
+            if (unsigned n = lines.skip(*pat, opt_ctx_b))
+              {
+                linenr += n;
+                before.clear();
+              }
 
-          if (exit_loop)
+          if (!lines.next(&d, &len, &terminated))
             break;
 
-          int idx = 0;
-          if (opt_igncase)
-            {
-              for (; idx < pattern.len(); ++idx)
-                if (pattern[idx] != tolower((*b)[i + idx]))
-                  break;
-            }
-          else
+          if (opt_inv ^ pat->match_line(d, len))
             {
-              for (; idx < pattern.len(); ++idx)
-                if (pattern[idx] != (*b)[i + idx])
-                  break;
+              ++count;
+              if (opt_count)
+                continue;
+
+              unsigned first = linenr - before.size();
+              for (Ctx_line const &c: before)
+                print_line(first++, false, c.pos, c.text.data(),
+                           c.text.size(), c.terminated);
+              before.clear();
+
+              print_line(linenr, true, lines.pos(), d, len, terminated);
+              print_until = linenr + opt_ctx_a + 1;
             }
-
-          if (idx == pattern.len() && (*b)[i] != '\n')
+          else if (opt_count)
+            continue;
+          else if (linenr < print_until)
+            print_line(linenr, false, lines.pos(), d, len, terminated);
+          else if (opt_ctx_b)
             {
-              if (!opt_word ||
-                  (!isalnum((*b)[i- 1]) && !isalnum((*b)[i + idx])))
-                is_match = true;
+              if (before.size() == opt_ctx_b)
+                before.pop_front();
+              before.push_back(Ctx_line{lines.pos(), std::string(d, len),
+                                        terminated});
             }
-
-          ++i;
-          exit_loop = i == end;
         }
 
-      unsigned last_output_idx = ~0U;
-
-      if (!opt_count)
-        for (unsigned linenr = 0; linenr < lines.size(); ++linenr)
-          {
-            if (lines[linenr].flags & Flag_print)
-              {
-                if (last_output_idx < linenr
-                    && last_output_idx != linenr - 1
-                    && (opt_ctx_a || opt_ctx_b))
-                  mux->printf("--\n");
-
-                if (!given_client)
-                  mux->printf("%s%c", v->tag().c_str(),
-                              lines[linenr].flags & Flag_match ? ':' : '-');
-                if (opt_line)
-                  mux->printf("%d%c", linenr + 1,
-                              lines[linenr].flags & Flag_match ? ':' : '-');
-
-                Client::Buf::Index le = lines[linenr].line;
-
-                while ((*b)[le] != '\n' && le != end)
-                  mux->printf("%c", (*b)[le++]);
-
-                if ((*b)[le] == '\n')
-                  mux->printf("\n");
-
-                last_output_idx = linenr;
-              }
-          }
-      else
+      if (opt_count)
         {
           if (!given_client)
             mux->printf("%s:", v->tag().c_str());
@@ -11,9 +11,15 @@
 #include "client.h"
 #include "mux.h"
 
+#include <l4/cxx/dlist>
 #include <l4/cxx/hlist>
 #include <l4/cxx/string>
 
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
 class String_set_iter
 {
 public:
@@ -95,20 +101,106 @@ private:
 
   static Cmd _cmds[];
 
-  struct Grep_lineinfo
+public:
+  typedef Client *Client_ptr;
+  typedef std::vector<Client_ptr> Client_list;
+
+private:
+  /**
+   * The clients sharing a tag.
+   *
+   * The clients are linked in creation order, which is also the order of
+   * their indexes, through Client::tag_prev and Client::tag_next.
+   */
+  struct Tag_clients
   {
-    explicit Grep_lineinfo(Client::Buf::Index l) : line(l), flags(0) {}
-    Client::Buf::Index line;
-    unsigned           flags;
+    std::string const *tag;   ///< Key of this entry in `_tags`.
+    Client_ptr first = nullptr, last = nullptr;
+    std::unordered_map<int, Client_ptr> by_idx;
   };
 
+  /// Orders tags, also against plain strings for range lookups.
+  struct Tag_order
+  {
+    typedef void is_transparent;
+
+    bool operator () (Tag_clients const *a, Tag_clients const *b) const
+    { return *a->tag < *b->tag; }
+
+    bool operator () (Tag_clients const *a, std::string const &tag) const
+    { return *a->tag < tag; }
+
+    bool operator () (std::string const &tag, Tag_clients const *b) const
+    { return tag < *b->tag; }
+  };
+
+  typedef std::set<Tag_clients const *, Tag_order> Tag_order_index;
+
 public:
-  typedef Client *Client_ptr;
-  typedef std::vector<Client_ptr> Client_list;
-  typedef Client_list::const_iterator Client_const_iter;
-  typedef Client_list::iterator Client_iter;
+  /**
+   * Iterator over clients sorted by tag and, for equal tags, by index.
+   */
+  class Client_index_iter
+  {
+  public:
+    Client_ptr operator * () const { return _c; }
+
+    Client_index_iter &operator ++ ()
+    {
+      _c = _c->tag_next;
+      if (!_c && ++_t != _end)
+        _c = (*_t)->first;
+      return *this;
+    }
+
+    bool operator == (Client_index_iter const &o) const { return _c == o._c; }
+    bool operator != (Client_index_iter const &o) const { return _c != o._c; }
+
+  private:
+    friend class Controller;
+
+    Client_index_iter(Tag_order_index::const_iterator t,
+                      Tag_order_index::const_iterator end)
+    : _t(t), _end(end), _c(t != end ? (*t)->first : nullptr)
+    {}
+
+    Tag_order_index::const_iterator _t, _end;
+    Client_ptr _c;
+  };
+
+  /// All clients in creation order.
+  cxx::D_list<Client> clients;
+
+  Client_index_iter sorted_begin() const
+  { return Client_index_iter(_sorted.begin(), _sorted.end()); }
+
+  Client_index_iter sorted_end() const
+  { return Client_index_iter(_sorted.end(), _sorted.end()); }
 
-  Client_list clients;
+  Client_index_iter prefix_begin(std::string const &prefix) const
+  { return Client_index_iter(_sorted.lower_bound(prefix), _sorted.end()); }
 
+  Client_index_iter prefix_end(std::string const &prefix) const;
+
+  bool tag_in_use(std::string const &tag) const
+  { return _tags.find(tag) != _tags.end(); }
+
+  void add_client(Client_ptr client);
   void remove_client(Client_ptr client);
+  void client_key(Client_ptr client, Client::Key key);
+
+  Client_ptr find_client(cxx::String const &name) const;
+
+  Client_ptr find_client(Client::Key key) const
+  { return key.is_nil() ? 0 : _keys[static_cast<unsigned char>(key.v())]; }
+
+private:
+  void update_key(Client::Key key);
+
+  typedef std::unordered_map<std::string, Tag_clients> Tag_index;
+  Tag_index _tags;
+  /// The entries of `_tags`, sorted by tag.
+  Tag_order_index _sorted;
+  /// First client in `clients` using a key, per key.
+  Client_ptr _keys[256] = {};
 };
@@ -8,16 +8,72 @@
 #pragma once
 
 #include <l4/cxx/hlist>
+#include <l4/sys/cxx/ipc_server_loop>
 #include "input_mux.h"
+#include "output_mux.h"
 
 class Frontend : public cxx::H_list_item
 {
 public:
+  /// Fragment of output for the vectored write().
+  struct Iov
+  {
+    char const *buf;
+    unsigned len;
+  };
+
   virtual int write(char const *buffer, unsigned size) = 0;
+
+  /**
+   * Write several fragments of output at once.
+   *
+   * Frontends should override this to pack the fragments into as few
+   * transfers as possible. The default writes the fragments one by one.
+   *
+   * \return Number of bytes written.
+   */
+  virtual int write(Iov const *iov, unsigned cnt)
+  {
+    int sz = 0;
+    for (unsigned i = 0; i < cnt; ++i)
+      for (unsigned l = 0; l < iov[i].len; )
+        {
+          int r = write(iov[i].buf + l, iov[i].len - l);
+          if (r < 0)
+            return sz;
+
+          l += r;
+          sz += r;
+        }
+    return sz;
+  }
   void input_mux(Input_mux *m) { _input = m; }
 
+  /// Write out output buffered by the frontend.
+  virtual void flush() {}
+
+  /**
+   * Allow the frontend to hold back output for some time, so that it can
+   * be written in larger chunks.
+   *
+   * \param us   Maximum delay in microseconds, 0 for no delay.
+   * \param sif  Server interface for the flush timeout.
+   */
+  virtual void flush_delay(unsigned /* us */,
+                           L4::Ipc_svr::Server_iface * /* sif */)
+  {}
+
+  /// Print statistics of the frontend.
+  virtual void info(Output_mux * /* out */) const {}
+
   virtual ~Frontend() = 0;
 
+  /**
+   * Check whether input is pending.
+   *
+   * Called repeatedly while a lot of output is produced, to stop it on user
+   * input. Should be cheap, preferably not involving IPC.
+   */
   virtual bool check_input() = 0;
 
 protected:
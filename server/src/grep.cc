@@ -0,0 +1,741 @@
+/*
+ * Copyright (C) 2026 Kernkonzept GmbH.
+ *
+ * License: see LICENSE.spdx (in this directory or the directories above)
+ */
+#include "grep.h"
+#include "scan.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <list>
+#include <memory>
+
+namespace {
+
+inline char
+fold(char c)
+{ return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c; }
+
+inline char
+upper(char c)
+{ return (c >= 'a' && c <= 'z') ? c - 'a' + 'A' : c; }
+
+}
+
+Grep_pattern::Grep_pattern(cxx::String const &pattern, bool igncase,
+                           bool word)
+: _p(pattern.start(), pattern.len()), _igncase(igncase), _word(word)
+{
+  if (_igncase)
+    for (char &c: _p)
+      c = fold(c);
+
+  if (_p.empty())
+    return;
+
+  _first[0] = _first[1] = _p.front();
+  _last[0] = _last[1] = _p.back();
+  if (_igncase)
+    {
+      _first[1] = upper(_first[0]);
+      _last[1] = upper(_last[0]);
+    }
+}
+
+bool
+Grep_pattern::equal(char const *p) const
+{
+  if (!_igncase)
+    return !memcmp(p, _p.data(), _p.size());
+
+  for (char c: _p)
+    if (c != fold(*p++))
+      return false;
+
+  return true;
+}
+
+bool
+Grep_pattern::word_at(char const *d, int len, int i) const
+{
+  int m = _p.size();
+  return (i == 0 || !isalnum(d[i - 1]))
+         && (i + m == len || !isalnum(d[i + m]));
+}
+
+char const *
+Grep_pattern::find(char const *p, char const *e) const
+{
+  if (_p.empty())
+    return p;
+
+  for (;; ++p)
+    {
+      p = find_first_last(p, e, _p.size(), _first[0], _first[1],
+                          _last[0], _last[1]);
+      if (p == e || equal(p))
+        return p;
+    }
+}
+
+bool
+Grep_pattern::match_line(char const *d, int len) const
+{
+  char const *e = d + len;
+
+  if (_p.empty())
+    {
+      // An empty pattern matches at every position of a non-empty line.
+      for (int i = 0; i < len; ++i)
+        if (!_word || word_at(d, len, i))
+          return true;
+      return false;
+    }
+
+  for (char const *p = d; (p = find(p, e)) != e; ++p)
+    if (!_word || word_at(d, len, p - d))
+      return true;
+
+  return false;
+}
+
+/**
+ * Parser of the expressions of `grep -E`, producing the NFA of a
+ * Grep_regex.
+ *
+ * The expression is parsed into a syntax tree first, so that bounded
+ * repetitions can simply generate their operand multiple times.
+ */
+class Regex_parser
+{
+public:
+  typedef Grep_regex::Set Set;
+  typedef Grep_regex::Node Node;
+
+  Regex_parser(cxx::String const &pattern, bool igncase)
+  : _p(pattern.start()), _e(pattern.end()), _igncase(igncase)
+  {}
+
+  /// \return Root of the syntax tree, -1 on errors.
+  int parse()
+  {
+    int r = alt(0);
+    if (r >= 0 && _p != _e)
+      return error("unmatched ')'");
+    return r;
+  }
+
+  /**
+   * Extend an expression to only match whole words.
+   *
+   * The expression must be preceded by the start of the line or a
+   * character that is not alphanumeric, and followed by such a character or
+   * the end of the line.
+   */
+  int word(int r)
+  {
+    Set nw;
+    for (unsigned c = 0; c < 256; ++c)
+      if (c != '\n' && !isalnum(c))
+        nw.set(c);
+
+    int pre = add(Ast::Alt, add(Ast::Bol), add_set(nw));
+    int post = add(Ast::Alt, add_set(nw), add(Ast::Eol));
+    return add(Ast::Cat, add(Ast::Cat, pre, r), post);
+  }
+
+  /**
+   * Generate the NFA for a syntax tree.
+   *
+   * \return False if the NFA would be too large.
+   */
+  bool generate(int root, Grep_regex *re)
+  {
+    _nodes = &re->_nodes;
+    int m = node(Node::Match, 0);
+    int s = m < 0 ? -1 : gen(root, m);
+    if (s < 0)
+      {
+        _err = "expression too complex";
+        return false;
+      }
+    re->_start = s;
+    return true;
+  }
+
+  char const *err() const { return _err; }
+
+private:
+  enum
+  {
+    Max_depth = 64,
+    Max_repeat = 255,
+    /// Maximum number of gen() calls, which may not all add NFA nodes.
+    Max_gen_calls = 16 * Grep_regex::Max_nodes,
+  };
+
+  struct Ast
+  {
+    enum Op { Sym, Bol, Eol, Empty, Cat, Alt, Repeat };
+    Op op;
+    int a, b;
+    int min, max;   ///< Bounds of a repetition, max < 0 for no bound.
+    Set set;
+  };
+
+  int error(char const *msg)
+  {
+    if (!_err)
+      _err = msg;
+    return -1;
+  }
+
+  int add(Ast::Op op, int a = -1, int b = -1)
+  {
+    _ast.push_back(Ast{op, a, b, 0, 0, Set()});
+    return _ast.size() - 1;
+  }
+
+  int add_set(Set const &s)
+  {
+    int r = add(Ast::Sym);
+    _ast[r].set = s;
+    return r;
+  }
+
+  int add_repeat(int a, int min, int max)
+  {
+    int r = add(Ast::Repeat, a);
+    _ast[r].min = min;
+    _ast[r].max = max;
+    return r;
+  }
+
+  void fold(Set *s) const
+  {
+    if (!_igncase)
+      return;
+
+    for (unsigned c = 'a'; c <= 'z'; ++c)
+      if (s->test(c) || s->test(c - 'a' + 'A'))
+        {
+          s->set(c);
+          s->set(c - 'a' + 'A');
+        }
+  }
+
+  static void add_class(Set *s, int (*is)(int))
+  {
+    for (unsigned c = 0; c < 256; ++c)
+      if (c != '\n' && is(c))
+        s->set(c);
+  }
+
+  static int is_word(int c)
+  { return isalnum(c) || c == '_'; }
+
+  int alt(unsigned depth)
+  {
+    int l = cat(depth);
+    while (l >= 0 && _p != _e && *_p == '|')
+      {
+        ++_p;
+        int r = cat(depth);
+        if (r < 0)
+          return -1;
+        l = add(Ast::Alt, l, r);
+      }
+    return l;
+  }
+
+  int cat(unsigned depth)
+  {
+    int l = add(Ast::Empty);
+    while (_p != _e && *_p != '|' && *_p != ')')
+      {
+        int r = repeat(depth);
+        if (r < 0)
+          return -1;
+        l = add(Ast::Cat, l, r);
+      }
+    return l;
+  }
+
+  int repeat(unsigned depth)
+  {
+    int a = atom(depth);
+    while (a >= 0 && _p != _e)
+      {
+        switch (*_p)
+          {
+          case '*': ++_p; a = add_repeat(a, 0, -1); break;
+          case '+': ++_p; a = add_repeat(a, 1, -1); break;
+          case '?': ++_p; a = add_repeat(a, 0, 1); break;
+          case '{':
+            {
+              ++_p;
+              int min = number(0), max = min;
+              if (_p != _e && *_p == ',')
+                {
+                  ++_p;
+                  max = number(-1);
+                }
+              if (_p == _e || *_p != '}' || min < -1 || max < -1
+                  || (max >= 0 && max < min))
+                return error("invalid repetition");
+              ++_p;
+              a = add_repeat(a, min, max);
+              break;
+            }
+          default:
+            return a;
+          }
+      }
+    return a;
+  }
+
+  /**
+   * Parse a decimal number of a repetition.
+   *
+   * \return The number, `dflt` if there is none, -2 if it is too large.
+   */
+  int number(int dflt)
+  {
+    if (_p == _e || !isdigit(*_p))
+      return dflt;
+
+    int n = 0;
+    for (; _p != _e && isdigit(*_p); ++_p)
+      if ((n = n * 10 + (*_p - '0')) > Max_repeat)
+        return -2;
+    return n;
+  }
+
+  int atom(unsigned depth)
+  {
+    Set s;
+    char c = *_p++;
+    switch (c)
+      {
+      case '(':
+        {
+          if (depth == Max_depth)
+            return error("expression too complex");
+          int r = alt(depth + 1);
+          if (r < 0)
+            return -1;
+          if (_p == _e || *_p != ')')
+            return error("unmatched '('");
+          ++_p;
+          return r;
+        }
+      case '*': case '+': case '?': case '{':
+        return error("nothing to repeat");
+      case '^':
+        return add(Ast::Bol);
+      case '$':
+        return add(Ast::Eol);
+      case '.':
+        for (unsigned c = 0; c < 256; ++c)
+          s.set(c);
+        s.reset('\n');
+        return add_set(s);
+      case '[':
+        return bracket();
+      case '\\':
+        if (_p == _e)
+          return error("trailing backslash");
+        c = *_p++;
+        switch (c)
+          {
+          case 'w': add_class(&s, is_word); return add_set(s);
+          case 's': add_class(&s, isspace); return add_set(s);
+          case 'W': add_class(&s, is_word); return add_set(negate(s));
+          case 'S': add_class(&s, isspace); return add_set(negate(s));
+          default: break;
+          }
+        break;
+      default:
+        break;
+      }
+
+    s.set(static_cast<unsigned char>(c));
+    fold(&s);
+    return add_set(s);
+  }
+
+  static Set negate(Set s)
+  {
+    for (unsigned c = 0; c < 256; ++c)
+      s.flip(c);
+    s.reset('\n');
+    return s;
+  }
+
+  int bracket()
+  {
+    static struct
+    {
+      char const *name;
+      int (*is)(int);
+    } const classes[] =
+    {
+      { "alnum", isalnum }, { "alpha", isalpha }, { "blank", isblank },
+      { "cntrl", iscntrl }, { "digit", isdigit }, { "graph", isgraph },
+      { "lower", islower }, { "print", isprint }, { "punct", ispunct },
+      { "space", isspace }, { "upper", isupper }, { "xdigit", isxdigit },
+    };
+
+    Set s;
+    bool neg = _p != _e && *_p == '^';
+    if (neg)
+      ++_p;
+
+    for (bool first = true;; first = false)
+      {
+        if (_p == _e)
+          return error("unmatched '['");
+
+        if (*_p == ']' && !first)
+          {
+            ++_p;
+            break;
+          }
+
+        if (*_p == '[' && _e - _p > 1 && _p[1] == ':')
+          {
+            char const *n = _p + 2;
+            char const *ne = n;
+            while (ne != _e && *ne != ':')
+              ++ne;
+            if (_e - ne < 2 || ne[1] != ']')
+              return error("unmatched '[:'");
+
+            bool found = false;
+            for (auto const &k: classes)
+              if (cxx::String(n, ne) == k.name)
+                {
+                  add_class(&s, k.is);
+                  found = true;
+                }
+            if (!found)
+              return error("invalid character class");
+
+            _p = ne + 2;
+            continue;
+          }
+
+        unsigned lo = static_cast<unsigned char>(*_p++);
+        unsigned hi = lo;
+        if (_e - _p > 1 && *_p == '-' && _p[1] != ']')
+          {
+            hi = static_cast<unsigned char>(_p[1]);
+            _p += 2;
+            if (hi < lo)
+              return error("invalid range");
+          }
+
+        for (unsigned c = lo; c <= hi; ++c)
+          s.set(c);
+      }
+
+    s.reset('\n');
+    fold(&s);
+    return add_set(neg ? negate(s) : s);
+  }
+
+  int node(Node::Type type, int out, int out1 = 0,
+           Set const &set = Set())
+  {
+    if (out < 0 || out1 < 0 || _nodes->size() >= Grep_regex::Max_nodes)
+      return -1;
+
+    _nodes->push_back(Node{type, static_cast<unsigned short>(out),
+                           static_cast<unsigned short>(out1), set});
+    return _nodes->size() - 1;
+  }
+
+  /**
+   * Generate the NFA nodes for a syntax tree, back to front.
+   *
+   * \param a     The syntax tree.
+   * \param next  Node to continue with after a match of `a`.
+   *
+   * \return Entry node, -1 if there are too many nodes or calls.
+   */
+  int gen(int a, int next)
+  {
+    // Repeating an operand without nodes, like `(){255}`, does not add any
+    // nodes, so the work has to be limited as well.
+    if (next < 0 || ++_gen_calls > Max_gen_calls)
+      return -1;
+
+    Ast const &t = _ast[a];
+    switch (t.op)
+      {
+      case Ast::Sym:   return node(Node::Sym, next, 0, t.set);
+      case Ast::Bol:   return node(Node::Bol, next);
+      case Ast::Eol:   return node(Node::Eol, next);
+      case Ast::Empty: return next;
+      case Ast::Cat:   return gen(t.a, gen(t.b, next));
+      case Ast::Alt:   return node(Node::Split, gen(t.a, next), gen(t.b, next));
+      case Ast::Repeat:
+        {
+          int e = next;
+          if (t.max < 0)
+            {
+              // Loop: a split either enters the operand, which returns to
+              // the split, or continues.
+              e = node(Node::Split, next, next);
+              if (e < 0)
+                return -1;
+              int body = gen(t.a, e);
+              if (body < 0)
+                return -1;
+              (*_nodes)[e].out = body;
+            }
+          else
+            for (int i = t.min; i < t.max; ++i)
+              e = node(Node::Split, gen(t.a, e), e);
+
+          for (int i = 0; i < t.min; ++i)
+            e = gen(t.a, e);
+          return e;
+        }
+      }
+    return -1;
+  }
+
+  char const *_p, *_e;
+  bool _igncase;
+  char const *_err = nullptr;
+  std::vector<Ast> _ast;
+  std::vector<Node> *_nodes = nullptr;
+  unsigned _gen_calls = 0;
+};
+
+bool
+Grep_regex::compile(cxx::String const &pattern, bool igncase, bool word,
+                    char const **err)
+{
+  Regex_parser p(pattern, igncase);
+  int r = p.parse();
+  if (r >= 0 && word)
+    r = p.word(r);
+
+  if (r < 0 || !p.generate(r, this))
+    {
+      *err = p.err();
+      return false;
+    }
+
+  return true;
+}
+
+Grep_regex const *
+Grep_regex::get(cxx::String const &pattern, bool igncase, bool word,
+                char const **err)
+{
+  enum { Cache_size = 8 };
+
+  struct Entry
+  {
+    std::string pattern;
+    bool igncase, word;
+    std::unique_ptr<Grep_regex> re;
+  };
+  static std::list<Entry> cache;
+
+  std::string p(pattern.start(), pattern.len());
+  for (auto i = cache.begin(); i != cache.end(); ++i)
+    if (i->pattern == p && i->igncase == igncase && i->word == word)
+      {
+        cache.splice(cache.begin(), cache, i);
+        return i->re.get();
+      }
+
+  std::unique_ptr<Grep_regex> re(new Grep_regex());
+  if (!re->compile(pattern, igncase, word, err))
+    return nullptr;
+
+  cache.push_front(Entry{p, igncase, word, std::move(re)});
+  if (cache.size() > Cache_size)
+    cache.pop_back();
+
+  return cache.front().re.get();
+}
+
+/**
+ * Compute the epsilon closure of a set of NFA nodes.
+ *
+ * \param s    The nodes, replaced by the Sym, Eol and Match nodes reachable
+ *             from them without consuming input, in ascending order.
+ * \param bol  At the start of a line, so that `^` can be passed.
+ * \param eol  At the end of a line, so that `$` can be passed.
+ */
+void
+Grep_regex::closure(Node_set *s, bool bol, bool eol) const
+{
+  std::vector<bool> seen(_nodes.size());
+  Node_set todo;
+  todo.swap(*s);
+
+  while (!todo.empty())
+    {
+      unsigned n = todo.back();
+      todo.pop_back();
+      if (seen[n])
+        continue;
+      seen[n] = true;
+
+      Node const &x = _nodes[n];
+      switch (x.type)
+        {
+        case Node::Split:
+          todo.push_back(x.out1);
+          todo.push_back(x.out);
+          break;
+        case Node::Bol:
+          if (bol)
+            todo.push_back(x.out);
+          break;
+        case Node::Eol:
+          if (eol)
+            todo.push_back(x.out);
+          else
+            s->push_back(n);
+          break;
+        default:
+          s->push_back(n);
+          break;
+        }
+    }
+
+  std::sort(s->begin(), s->end());
+}
+
+/**
+ * Get the DFA state for a set of NFA nodes, adding it if necessary.
+ *
+ * If there are too many DFA states, all of them are discarded first.
+ */
+int
+Grep_regex::state(Node_set const &s) const
+{
+  auto i = _state_ids.find(s);
+  if (i != _state_ids.end())
+    return i->second;
+
+  if (_states.size() == Max_states)
+    {
+      _state_ids.clear();
+      _states.clear();
+      _accept.clear();
+      _trans.clear();
+      _start_state = -1;
+      ++_generation;
+    }
+
+  int id = _states.size();
+  _state_ids[s] = id;
+  _states.push_back(s);
+  _accept.push_back(std::any_of(s.begin(), s.end(), [this](unsigned n)
+                                { return n != At_bol
+                                         && _nodes[n].type == Node::Match; }));
+  _trans.resize(_trans.size() + Num_symbols, -1);
+  return id;
+}
+
+int
+Grep_regex::start() const
+{
+  if (_start_state < 0)
+    {
+      Node_set s(1, _start);
+      closure(&s, true, false);
+      // `^` can also be passed at the end of an empty line.
+      s.push_back(At_bol);
+      _start_state = state(s);
+    }
+  return _start_state;
+}
+
+/**
+ * Compute the DFA state following state `s` on input symbol `c`, which
+ * is not known yet.
+ */
+int
+Grep_regex::add_step(int s, unsigned c) const
+{
+  Node_set const &cur = _states[s];
+  Node_set n;
+  bool bol = !cur.empty() && cur.back() == At_bol;
+  if (c == Eol)
+    {
+      n = cur;
+      if (bol)
+        n.pop_back();
+      closure(&n, bol, true);
+    }
+  else
+    {
+      for (unsigned i: cur)
+        if (i != At_bol && _nodes[i].type == Node::Sym && _nodes[i].set.test(c))
+          n.push_back(_nodes[i].out);
+
+      // A match may start at any position of the line.
+      n.push_back(_start);
+      closure(&n, false, false);
+    }
+
+  unsigned gen = _generation;
+  int t = state(n);
+  // Only record the transition if `s` was not discarded meanwhile.
+  if (gen == _generation)
+    _trans[s * Num_symbols + c] = t;
+  return t;
+}
+
+char const *
+Grep_regex::find(char const *p, char const *e) const
+{
+  int s = start();
+  if (_accept[s])
+    return p;
+
+  for (; p != e; ++p)
+    {
+      if (*p == '\n')
+        {
+          if (_accept[step(s, Eol)])
+            return p;
+          s = start();
+          continue;
+        }
+
+      s = step(s, static_cast<unsigned char>(*p));
+      if (_accept[s])
+        return p;
+    }
+
+  return e;
+}
+
+bool
+Grep_regex::match_line(char const *d, int len) const
+{
+  int s = start();
+  if (_accept[s])
+    return true;
+
+  for (int i = 0; i < len; ++i)
+    {
+      s = step(s, static_cast<unsigned char>(d[i]));
+      if (_accept[s])
+        return true;
+    }
+
+  return _accept[step(s, Eol)];
+}
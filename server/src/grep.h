@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2026 Kernkonzept GmbH.
+ *
+ * License: see LICENSE.spdx (in this directory or the directories above)
+ */
+#pragma once
+
+#include <l4/cxx/string>
+
+#include <bitset>
+#include <map>
+#include <string>
+#include <vector>
+
+/**
+ * Pattern of the `grep` command.
+ */
+class Grep_matcher
+{
+public:
+  /**
+   * Find the first line containing the pattern, not considering word
+   * boundaries for fixed strings.
+   *
+   * Must be called at the start of a line. The data may span multiple
+   * lines separated by newline characters.
+   *
+   * \return Pointer into the first matching line, `e` if there is none.
+   */
+  virtual char const *find(char const *p, char const *e) const = 0;
+
+  /**
+   * Check whether a line contains the pattern.
+   *
+   * \param d    Line content without its newline character.
+   * \param len  Length of the line.
+   */
+  virtual bool match_line(char const *d, int len) const = 0;
+
+protected:
+  ~Grep_matcher() = default;
+};
+
+/**
+ * Fixed string pattern of the `grep` command.
+ *
+ * Occurrences are found by checking the first and last byte of the pattern
+ * for many positions at once and comparing the whole pattern only at the
+ * remaining candidates.
+ */
+class Grep_pattern : public Grep_matcher
+{
+public:
+  /**
+   * \param pattern  String to search for.
+   * \param igncase  Compare case-insensitively.
+   * \param word     Only match whole words.
+   */
+  Grep_pattern(cxx::String const &pattern, bool igncase, bool word);
+
+  /// \return Start of the first occurrence, `e` if there is none.
+  char const *find(char const *p, char const *e) const override;
+  bool match_line(char const *d, int len) const override;
+
+private:
+  bool equal(char const *p) const;
+  bool word_at(char const *d, int len, int i) const;
+
+  std::string _p;   ///< The pattern, lower case if `_igncase` is set.
+  bool _igncase;
+  bool _word;
+  char _first[2];   ///< Possible values of the first byte.
+  char _last[2];    ///< Possible values of the last byte.
+};
+
+/**
+ * Extended regular expression of `grep -E`.
+ *
+ * Supported are literals, `.`, bracket expressions including ranges and
+ * character classes like `[:alpha:]`, `\w`, `\W`, `\s`, `\S`, the
+ * anchors `^` and `$`, grouping, alternation and the repetitions `*`, `+`,
+ * `?` and `{n,m}`.
+ *
+ * Words in the sense of `\w` and `\W` consist of alphanumeric characters
+ * and `_`. When only whole words shall be matched, words are delimited by
+ * any character that is not alphanumeric, like for Grep_pattern, so `_`
+ * separates words there.
+ *
+ * The expression is compiled to an NFA, which is turned into a DFA one
+ * state at a time while searching. Each byte is looked at once, there is
+ * no backtracking.
+ */
+class Grep_regex : public Grep_matcher
+{
+public:
+  /**
+   * Get a compiled expression.
+   *
+   * The last compiled expressions are kept together with the DFA states
+   * built for them, so that repeating a search is cheap.
+   *
+   * \param      pattern  The expression.
+   * \param      igncase  Match case-insensitively.
+   * \param      word     Only match whole words.
+   * \param[out] err      Error message if the expression is invalid.
+   *
+   * \return The expression, nullptr if it is invalid.
+   */
+  static Grep_regex const *get(cxx::String const &pattern, bool igncase,
+                               bool word, char const **err);
+
+  char const *find(char const *p, char const *e) const override;
+  bool match_line(char const *d, int len) const override;
+
+private:
+  enum
+  {
+    Eol = 256,          ///< Input symbol for the end of a line.
+    Num_symbols = 257,
+    Max_nodes = 4096,
+    Max_states = 128,
+    At_bol = 0xffff,    ///< Last element of the node set of the start state.
+  };
+
+  typedef std::bitset<256> Set;
+  typedef std::vector<unsigned short> Node_set;
+
+  struct Node
+  {
+    /// Sym consumes a byte, Bol and Eol are the anchors `^` and `$`.
+    enum Type : unsigned char { Sym, Split, Bol, Eol, Match };
+    Type type;
+    unsigned short out, out1;
+    Set set;            ///< Bytes a Sym node consumes.
+  };
+
+  Grep_regex() = default;
+
+  bool compile(cxx::String const &pattern, bool igncase, bool word,
+               char const **err);
+
+  void closure(Node_set *s, bool bol, bool eol) const;
+  int state(Node_set const &s) const;
+  int start() const;
+  int add_step(int s, unsigned c) const;
+
+  /// Get the DFA state following state `s` on input symbol `c`.
+  int step(int s, unsigned c) const
+  {
+    int t = _trans[s * Num_symbols + c];
+    return t >= 0 ? t : add_step(s, c);
+  }
+
+  std::vector<Node> _nodes;
+  unsigned short _start = 0;
+
+  // The DFA built so far.
+  mutable std::map<Node_set, int> _state_ids;
+  mutable std::vector<Node_set> _states;
+  mutable std::vector<char> _accept;
+  mutable std::vector<short> _trans;
+  mutable int _start_state = -1;
+  /// Incremented whenever all DFA states are discarded.
+  mutable unsigned _generation = 0;
+
+  friend class Regex_parser;
+};
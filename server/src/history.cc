@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2026 Kernkonzept GmbH.
+ *
+ * License: see LICENSE.spdx (in this directory or the directories above)
+ */
+#include "history.h"
+
+History::History(Client const *c)
+: _hot(c->wbuf()), _cold(c->compressed_history())
+{
+  // The cold history is only needed if it reaches behind the write buffer.
+  if (   _cold
+      && (_cold->empty() || long(_cold->begin() - _hot->tail_pos()) >= 0))
+    _cold = nullptr;
+}
+
+unsigned long
+History::tail(unsigned n) const
+{
+  if (!n)
+    return end();
+
+  unsigned hn = _hot->newlines();
+  if (n <= hn)
+    return _hot->newline_pos(hn - n) + 1;
+
+  unsigned long p;
+  if (_cold && _cold->rfind_newline(_hot->tail_pos(), n - hn, &p))
+    return p + 1;
+
+  // Fewer lines than requested. A newline character at the very start only
+  // terminates a line that is no longer part of the history.
+  char const *d;
+  if (Reader(*this, start()).next(&d) && *d == '\n')
+    return start() + 1;
+
+  return start();
+}
+
+History::Reader::Reader(History const &h, unsigned long from)
+: _hot(h._hot),
+  _pos(h._hot->at(long(from - h._hot->tail_pos()) > 0
+                  ? from : h._hot->tail_pos())),
+  _cold(h._cold, from, h._hot->tail_pos())
+{}
+
+unsigned
+History::Reader::next(char const **d)
+{
+  if (unsigned l = _cold.next(d))
+    return l;
+
+  int l = _hot->span(_pos, _hot->head(), d);
+  _pos = _pos + l;
+  return l;
+}
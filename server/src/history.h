@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2026 Kernkonzept GmbH.
+ *
+ * License: see LICENSE.spdx (in this directory or the directories above)
+ */
+#pragma once
+
+#include "client.h"
+#include "cold_history.h"
+
+/**
+ * Complete output history of a client.
+ *
+ * The history consists of the compressed cold history, if any, followed by
+ * the content of the client's write buffer. The write buffer is
+ * authoritative for every position it still holds.
+ */
+class History
+{
+public:
+  explicit History(Client const *c);
+
+  /// Absolute position of the oldest byte.
+  unsigned long start() const
+  { return _cold ? _cold->begin() : _hot->tail_pos(); }
+
+  /// Absolute position behind the newest byte.
+  unsigned long end() const { return _hot->head_pos(); }
+
+  /**
+   * Get the start of the last lines.
+   *
+   * \param n  Number of lines.
+   *
+   * \return Absolute position behind the newline character terminating the
+   *         line before the last `n` lines, or the start of the history if
+   *         there are fewer lines.
+   */
+  unsigned long tail(unsigned n) const;
+
+  /**
+   * Sequential reader over a range of the history.
+   */
+  class Reader
+  {
+  public:
+    /**
+     * \param h     History to read.
+     * \param from  Absolute start position.
+     */
+    Reader(History const &h, unsigned long from);
+
+    /**
+     * Get the next run of bytes.
+     *
+     * \param[out] d  Start of the run, valid until the next call.
+     *
+     * \return Length of the run, 0 at the end of the history.
+     */
+    unsigned next(char const **d);
+
+  private:
+    Client::Buf const *_hot;
+    Client::Buf::Index _pos;
+    Cold_history::Reader _cold;
+  };
+
+private:
+  Client::Buf const *_hot;
+  Cold_history const *_cold;
+};
@@ -0,0 +1,193 @@
+/*
+ * Copyright (C) 2026 Kernkonzept GmbH.
+ *
+ * License: see LICENSE.spdx (in this directory or the directories above)
+ */
+#include "lz.h"
+
+#include <l4/cxx/minmax>
+#include <l4/sys/l4int.h>
+
+#include <cstring>
+
+namespace {
+
+enum
+{
+  Min_match = 4,
+  Hash_bits = 12,
+  Len_mask = 15,
+};
+
+typedef unsigned char Byte;
+
+inline l4_uint32_t read32(Byte const *p)
+{
+  l4_uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+inline unsigned hash(l4_uint32_t v)
+{ return (v * 2654435761U) >> (32 - Hash_bits); }
+
+/// Write the extension bytes of a length, return false on overflow.
+inline bool put_len(Byte **op, Byte const *oend, unsigned l)
+{
+  for (; l >= 255; l -= 255)
+    {
+      if (*op >= oend)
+        return false;
+      *(*op)++ = 255;
+    }
+
+  if (*op >= oend)
+    return false;
+  *(*op)++ = l;
+  return true;
+}
+
+/// Read the extension bytes of a length, return false on malformed input.
+inline bool get_len(Byte const **ip, Byte const *iend, unsigned *l)
+{
+  Byte b;
+  do
+    {
+      if (*ip >= iend)
+        return false;
+      b = *(*ip)++;
+      *l += b;
+    }
+  while (b == 255);
+
+  return true;
+}
+
+/// Emit one sequence, `mlen` is zero for the final literals-only sequence.
+bool emit(Byte **op, Byte const *oend, Byte const *lit, unsigned llen,
+          unsigned off, unsigned mlen)
+{
+  if (*op >= oend)
+    return false;
+
+  Byte *token = (*op)++;
+  unsigned ml = mlen ? mlen - Min_match : 0;
+  *token = (cxx::min<unsigned>(llen, Len_mask) << 4)
+           | cxx::min<unsigned>(ml, Len_mask);
+
+  if (llen >= Len_mask && !put_len(op, oend, llen - Len_mask))
+    return false;
+
+  if ((unsigned)(oend - *op) < llen)
+    return false;
+  if (llen)
+    memcpy(*op, lit, llen);
+  *op += llen;
+
+  if (!mlen)
+    return true;
+
+  if (oend - *op < 2)
+    return false;
+  *(*op)++ = off & 0xff;
+  *(*op)++ = off >> 8;
+
+  return ml < Len_mask || put_len(op, oend, ml - Len_mask);
+}
+
+}
+
+unsigned
+Lz::compress(char const *src, unsigned len, char *dst, unsigned cap)
+{
+  l4_uint16_t table[1 << Hash_bits];
+  memset(table, 0, sizeof(table));
+
+  Byte const *const base = reinterpret_cast<Byte const *>(src);
+  Byte const *const end = base + len;
+  Byte const *ip = base;
+  Byte const *anchor = base;
+  Byte *op = reinterpret_cast<Byte *>(dst);
+  Byte const *const oend = op + cap;
+
+  if (len > Max_block)
+    return 0;
+
+  while (len >= Min_match && ip <= end - Min_match)
+    {
+      l4_uint32_t v = read32(ip);
+      unsigned h = hash(v);
+      Byte const *ref = base + table[h];
+      table[h] = ip - base;
+
+      if (ref >= ip || read32(ref) != v)
+        {
+          ++ip;
+          continue;
+        }
+
+      Byte const *m = ip + Min_match;
+      for (Byte const *r = ref + Min_match; m < end && *m == *r; ++m, ++r)
+        ;
+
+      if (!emit(&op, oend, anchor, ip - anchor, ip - ref, m - ip))
+        return 0;
+
+      ip = anchor = m;
+    }
+
+  if (!emit(&op, oend, anchor, end - anchor, 0, 0))
+    return 0;
+
+  return op - reinterpret_cast<Byte *>(dst);
+}
+
+int
+Lz::decompress(char const *src, unsigned len, char *dst, unsigned cap)
+{
+  Byte const *ip = reinterpret_cast<Byte const *>(src);
+  Byte const *const iend = ip + len;
+  Byte *const base = reinterpret_cast<Byte *>(dst);
+  Byte *op = base;
+  Byte const *const oend = base + cap;
+
+  while (ip < iend)
+    {
+      unsigned token = *ip++;
+
+      unsigned llen = token >> 4;
+      if (llen == Len_mask && !get_len(&ip, iend, &llen))
+        return -1;
+
+      if (llen > (unsigned)(iend - ip) || llen > (unsigned)(oend - op))
+        return -1;
+      memcpy(op, ip, llen);
+      ip += llen;
+      op += llen;
+
+      // The final sequence has no match part.
+      if (ip == iend)
+        break;
+
+      if (iend - ip < 2)
+        return -1;
+      unsigned off = ip[0] | (ip[1] << 8);
+      ip += 2;
+      if (!off || off > (unsigned)(op - base))
+        return -1;
+
+      unsigned mlen = token & Len_mask;
+      if (mlen == Len_mask && !get_len(&ip, iend, &mlen))
+        return -1;
+      mlen += Min_match;
+
+      if (mlen > (unsigned)(oend - op))
+        return -1;
+
+      // Matches may overlap their own output, so copy byte by byte.
+      for (Byte const *m = op - off; mlen; --mlen)
+        *op++ = *m++;
+    }
+
+  return op - base;
+}
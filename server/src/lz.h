@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2026 Kernkonzept GmbH.
+ *
+ * License: see LICENSE.spdx (in this directory or the directories above)
+ */
+#pragma once
+
+/**
+ * Small LZ77 block codec.
+ *
+ * The format is LZ4-like: a sequence consists of a token holding the literal
+ * and match lengths, the literals, a 16-bit offset and optional length
+ * extension bytes. The end-of-block rules of LZ4 (last literals, minimum
+ * distance of the last match to the end) are not followed, so blocks can
+ * only be decoded by decompress(). Blocks must not exceed Max_block bytes.
+ */
+namespace Lz {
+
+enum { Max_block = 0xffff };
+
+/// Worst-case compressed size of `len` bytes.
+constexpr unsigned bound(unsigned len)
+{ return len + len / 255 + 16; }
+
+/**
+ * Compress a block.
+ *
+ * \param src  Uncompressed data.
+ * \param len  Length of `src`, at most Max_block.
+ * \param dst  Buffer for the compressed data.
+ * \param cap  Size of `dst`.
+ *
+ * \return Length of the compressed data, 0 if it does not fit into `dst`.
+ */
+unsigned compress(char const *src, unsigned len, char *dst, unsigned cap);
+
+/**
+ * Decompress a block.
+ *
+ * \param src  Compressed data.
+ * \param len  Length of `src`.
+ * \param dst  Buffer for the uncompressed data.
+ * \param cap  Size of `dst`.
+ *
+ * \return Length of the uncompressed data, -1 if `src` is malformed or does
+ *         not fit into `dst`.
+ */
+int decompress(char const *src, unsigned len, char *dst, unsigned cap);
+
+}
@@ -7,7 +7,6 @@
  */
 
 // TODO: compressed output (maybe 'dump' command, or cat -z or so)
-// TODO: store buffer compressed
 // TODO: port libxz (http://tukaani.org/xz/)
 // TODO: macro to inject some text into the read buffer
 
@@ -19,7 +18,9 @@
 #include "vcon_client.h"
 #include "vcon_fe.h"
 #include "virtio_client.h"
+#ifdef CONFIG_CONS_USE_ASYNC_FE
 #include "async_vcon_fe.h"
+#endif
 #include "registry.h"
 #include "server.h"
 #include "virtio_console_fe.h"
@@ -64,13 +65,49 @@ struct Config_opts
   unsigned default_line_buffering_ms = 50;
   // By default, show time stamps for all consoles.
   bool default_timestamp;
+  // Budget in bytes for the compressed history of each console, 0 disables.
+  unsigned long default_compressed_history = 0;
+  // Flush delay in microseconds for the frontends of the default mux.
+  unsigned default_flush_delay = 0;
+  // Output buffer size and overflow policy of virtio console frontends.
+  unsigned virtio_fe_bufsize = Virtio_console_fe::Default_obuf_size;
+  bool virtio_fe_drop_oldest = false;
   // Currently unused.
   std::string auto_connect_console;
 };
 
 static Config_opts config;
 
-static L4::Server<L4Re::Util::Br_manager_timeout_hooks> server;
+/**
+ * Server loop hooks writing out the frontend output once per iteration.
+ */
+struct Loop_hooks : public L4Re::Util::Br_manager_timeout_hooks
+{
+  L4::Ipc_svr::Reply_mode before_reply(l4_msgtag_t tag, l4_utcb_t *utcb)
+  {
+    // Flushing needs IPC, which must not happen before the reply was sent.
+    if (Vcon_fe_base::output_pending())
+      return L4::Ipc_svr::Reply_separate;
+
+    return Br_manager_timeout_hooks::before_reply(tag, utcb);
+  }
+
+  void setup_wait(l4_utcb_t *utcb, L4::Ipc_svr::Reply_mode mode)
+  {
+    // Handles the expired timeouts, which might produce output.
+    Br_manager_timeout_hooks::setup_wait(utcb, mode);
+
+    if (   mode == L4::Ipc_svr::Reply_separate
+        && Vcon_fe_base::output_pending())
+      {
+        Vcon_fe_base::flush_pending();
+        // Flushing used the UTCB, set up the receive buffers again.
+        L4Re::Util::Br_manager::setup_wait(utcb, mode);
+      }
+  }
+};
+
+static L4::Server<Loop_hooks> server;
 static Registry registry(&server);
 
 class My_mux : public Mux_i, public cxx::H_list_item
@@ -145,19 +182,11 @@ int
 Cons_svr::create(std::string const &tag, int color, CLI **vout, size_t bufsz,
                  Client::Key key, bool line_buffering, unsigned line_buffering_ms)
 {
-  typedef Controller::Client_iter Client_iter;
-  Client_iter c = std::find_if(_ctl.clients.begin(),
-                               Client_iter(_ctl.clients.end()),
-                               Client::Equal_key(key));
-  if (c != _ctl.clients.end())
+  if (_ctl.find_client(key))
     sys_msg("WARNING: multiple clients with key '%c'\n", key.v());
 
   std::string name = tag.length() > 0 ? tag : "<noname>";
 
-  auto it =
-    std::find_if(_ctl.clients.rbegin(), _ctl.clients.rend(),
-                 Client::Equal_tag(cxx::String(name.data(), name.length())));
-
   CLI *v = new CLI(name, color, bufsz, key, line_buffering, line_buffering_ms,
                    &registry, &server, &_ctl);
   if (!v)
@@ -169,14 +198,9 @@ Cons_svr::create(std::string const &tag, int color, CLI **vout, size_t bufsz,
       return -L4_ENOMEM;
     }
 
-  if (it != _ctl.clients.rend())
-    {
-      sys_msg("WARNING: multiple clients with tag '%s'\n", name.c_str());
-      v->idx = (*it)->idx + 1;
-      _ctl.clients.push_back(v);
-    }
-  else
-    _ctl.clients.push_back(v);
+  if (_ctl.tag_in_use(name))
+    sys_msg("WARNING: multiple clients with tag '%s'\n", name.c_str());
+  _ctl.add_client(v);
 
   sys_msg("Created vcon channel: %s [%lx]\n",
           v->tag().c_str(), v->obj_cap().cap());
@@ -241,8 +265,10 @@ Cons_svr::op_create(L4::Factory::Rights, L4::Ipc::Cap<void> &obj,
           bool line_buffering = config.default_line_buffering;
           unsigned line_buffering_ms = config.default_line_buffering_ms;
           bool timestamp = config.default_timestamp;
+          unsigned long compressed_history = config.default_compressed_history;
           Client::Key key;
           size_t bufsz = 0;
+          unsigned long ring = 0;
 
           for (L4::Ipc::Varg opts: args)
             {
@@ -272,6 +298,10 @@ Cons_svr::op_create(L4::Factory::Rights, L4::Ipc::Cap<void> &obj,
                     key = *k;
                   else if (cxx::String::Index v = cs.starts_with("bufsz="))
                     cs.substr(v).from_dec(&bufsz);
+                  else if (cxx::String::Index h = cs.starts_with("compressed-history="))
+                    cs.substr(h).from_dec(&compressed_history);
+                  else if (cxx::String::Index r = cs.starts_with("ring="))
+                    cs.substr(r).from_dec(&ring);
                 }
             }
 
@@ -292,6 +322,8 @@ Cons_svr::op_create(L4::Factory::Rights, L4::Ipc::Cap<void> &obj,
               if (int r = create(ts, color, &_v, bufsz, key,
                                  line_buffering, line_buffering_ms))
                 return r;
+              if (ring && !_v->setup_ring(ring, &registry))
+                sys_msg("WARNING: no log ring for '%s'\n", _v->tag().c_str());
               v = _v;
               v_cap = _v->obj_cap();
             }
@@ -303,6 +335,7 @@ Cons_svr::op_create(L4::Factory::Rights, L4::Ipc::Cap<void> &obj,
             v->keep(v);
 
           v->timestamp(timestamp);
+          v->compressed_history(compressed_history);
 
           for (Mux_iter i = _muxe.begin(); i != _muxe.end(); ++i)
             {
@@ -336,6 +369,13 @@ int main(int argc, char const *argv[])
     OPT_KEEP = 'k',
     OPT_NO_LINE_BUFFERING = 'l',
     OPT_LINE_BUFFERING_MS = 1,
+    OPT_MIRROR_BUFFERS = 2,
+    OPT_COMPRESSED_HISTORY = 3,
+    OPT_TIMESTAMP_FORMAT = 4,
+    OPT_FLUSH_DELAY = 5,
+    OPT_FRONTEND_OVERFLOW = 6,
+    OPT_VFE_BUFSIZE = 7,
+    OPT_VFE_OVERFLOW = 8,
     OPT_TIMESTAMP = 't',
     OPT_AUTOCONNECT = 'c',
     OPT_DEFAULT_NAME = 'n',
@@ -352,9 +392,16 @@ int main(int argc, char const *argv[])
     { "no-line-buffering", no_argument,       0, OPT_NO_LINE_BUFFERING },
     { "line-buffering-ms", required_argument, 0, OPT_LINE_BUFFERING_MS },
     { "timestamp",         no_argument,       0, OPT_TIMESTAMP },
+    { "timestamp-format",  required_argument, 0, OPT_TIMESTAMP_FORMAT },
+    { "flush-delay",       required_argument, 0, OPT_FLUSH_DELAY },
+    { "frontend-overflow", required_argument, 0, OPT_FRONTEND_OVERFLOW },
+    { "virtio-frontend-bufsize", required_argument, 0, OPT_VFE_BUFSIZE },
+    { "virtio-frontend-overflow", required_argument, 0, OPT_VFE_OVERFLOW },
     { "autoconnect",       required_argument, 0, OPT_AUTOCONNECT },
     { "defaultname",       required_argument, 0, OPT_DEFAULT_NAME },
     { "defaultbufsize",    required_argument, 0, OPT_DEFAULT_BUFSIZE },
+    { "mirror-buffers",    no_argument,       0, OPT_MIRROR_BUFFERS },
+    { "compressed-history", required_argument, 0, OPT_COMPRESSED_HISTORY },
     { 0, 0, 0, 0 },
   };
 
@@ -421,7 +468,9 @@ int main(int argc, char const *argv[])
               break;
             }
           {
-            auto fe = new Virtio_console_fe(&registry);
+            auto fe = new Virtio_console_fe(&registry,
+                                            config.virtio_fe_bufsize,
+                                            config.virtio_fe_drop_oldest);
             auto cap = registry.register_obj(fe, optarg);
 
             L4Re::chkcap(cap, "Could not register virtio_console "
@@ -435,6 +484,10 @@ int main(int argc, char const *argv[])
         case OPT_TIMESTAMP:
           config.default_timestamp = true;
           break;
+        case OPT_TIMESTAMP_FORMAT:
+          if (!Timestamp::set_format(optarg))
+            printf("WARNING: Unknown timestamp format '%s'.\n", optarg);
+          break;
         case OPT_AUTOCONNECT:
           if (current_mux)
             current_mux->add_auto_connect_console(optarg);
@@ -453,6 +506,39 @@ int main(int argc, char const *argv[])
         case OPT_LINE_BUFFERING_MS:
           config.default_line_buffering_ms = atoi(optarg);
           break;
+        case OPT_MIRROR_BUFFERS:
+          Client::mirror_buffers(true);
+          break;
+        case OPT_COMPRESSED_HISTORY:
+          config.default_compressed_history = strtoul(optarg, 0, 0);
+          break;
+        case OPT_FLUSH_DELAY:
+          if (current_mux)
+            current_mux->flush_delay(atoi(optarg), &server);
+          else
+            config.default_flush_delay = atoi(optarg);
+          break;
+        case OPT_VFE_BUFSIZE:
+          config.virtio_fe_bufsize = strtoul(optarg, 0, 0);
+          break;
+        case OPT_VFE_OVERFLOW:
+          if (!strcmp(optarg, "drop-oldest"))
+            config.virtio_fe_drop_oldest = true;
+          else if (!strcmp(optarg, "drop"))
+            config.virtio_fe_drop_oldest = false;
+          else
+            printf("WARNING: Unknown virtio frontend overflow policy '%s'.\n",
+                   optarg);
+          break;
+        case OPT_FRONTEND_OVERFLOW:
+#ifdef CONFIG_CONS_USE_ASYNC_FE
+          if (!Async_vcon_fe::overflow_policy(optarg))
+            printf("WARNING: Unknown frontend overflow policy '%s'.\n", optarg);
+#else
+          printf("WARNING: Ignoring --frontend-overflow, asynchronous "
+                 "frontends are not enabled.\n");
+#endif
+          break;
         }
     }
 
@@ -461,6 +547,7 @@ int main(int argc, char const *argv[])
     {
       current_mux = new My_mux(cons->ctl(), default_name);
       cons->add(current_mux);
+      current_mux->flush_delay(config.default_flush_delay, &server);
       current_fe = new Fe(L4Re::Env::env()->log(), &registry);
       current_mux->add_frontend(current_fe);
       for (Str_vector::const_iterator i = ac_consoles.begin();
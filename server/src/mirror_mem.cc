@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2026 Kernkonzept GmbH.
+ *
+ * License: see LICENSE.spdx (in this directory or the directories above)
+ */
+#include "mirror_mem.h"
+
+#include <l4/re/env>
+#include <l4/re/mem_alloc>
+#include <l4/re/rm>
+
+Mirror_mem::~Mirror_mem()
+{ release(); }
+
+bool
+Mirror_mem::alloc(unsigned long size)
+{
+  L4Re::Env const *e = L4Re::Env::env();
+
+  _ds = L4Re::Util::make_unique_cap<L4Re::Dataspace>();
+  if (!_ds.is_valid() || e->mem_alloc()->alloc(size, _ds.get()) < 0)
+    {
+      release();
+      return false;
+    }
+
+  l4_addr_t area = 0;
+  if (e->rm()->reserve_area(&area, 2 * size, L4Re::Rm::F::Search_addr) < 0)
+    {
+      release();
+      return false;
+    }
+
+  _addr = area;
+  _size = size;
+
+  auto const flags = L4Re::Rm::F::In_area | L4Re::Rm::F::Eager_map
+                     | L4Re::Rm::F::RW;
+  for (l4_addr_t a = area; a < area + 2 * size; a += size)
+    {
+      l4_addr_t at = a;
+      if (e->rm()->attach(&at, size, flags,
+                          L4::Ipc::make_cap_rw(_ds.get())) < 0)
+        {
+          release();
+          return false;
+        }
+    }
+
+  return true;
+}
+
+void
+Mirror_mem::release()
+{
+  if (_addr)
+    {
+      L4Re::Env const *e = L4Re::Env::env();
+      // Detaching an address that was never attached fails harmlessly.
+      e->rm()->detach(_addr, 0);
+      e->rm()->detach(_addr + _size, 0);
+      e->rm()->free_area(_addr);
+      _addr = 0;
+      _size = 0;
+    }
+
+  // Also free the memory if the caller falls back to other memory.
+  _ds.reset();
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2026 Kernkonzept GmbH.
+ *
+ * License: see LICENSE.spdx (in this directory or the directories above)
+ */
+#pragma once
+
+#include <l4/re/dataspace>
+#include <l4/re/util/unique_cap>
+
+/**
+ * Memory region that is mapped twice, back to back.
+ *
+ * Byte `i` and byte `i + size()` of the region refer to the same memory, so
+ * any range of up to `size()` bytes starting inside the first mapping is
+ * contiguous in the virtual address space.
+ */
+class Mirror_mem
+{
+public:
+  Mirror_mem() = default;
+  ~Mirror_mem();
+
+  /**
+   * Allocate and map the memory.
+   *
+   * \param size  Size of the memory in bytes, must be a multiple of the page
+   *              size.
+   *
+   * \retval True   The memory is mapped twice at addr().
+   * \retval False  The memory could not be allocated or mapped.
+   */
+  bool alloc(unsigned long size);
+
+  char *addr() const { return reinterpret_cast<char *>(_addr); }
+
+private:
+  Mirror_mem(Mirror_mem const &) = delete;
+  Mirror_mem &operator = (Mirror_mem const &) = delete;
+
+  void release();
+
+  L4Re::Util::Unique_cap<L4Re::Dataspace> _ds;
+  l4_addr_t _addr = 0;
+  unsigned long _size = 0;
+};
@@ -15,4 +15,6 @@ class Mux : public Input_mux, public Output_mux
 {
 public:
   virtual void add_frontend(Frontend *) = 0;
+  /// Print the statistics of all frontends of the mux.
+  virtual void frontend_info() = 0;
 };
@@ -8,56 +8,30 @@
 
 #include "frontend.h"
 #include "client.h"
+#include "history.h"
 #include "mux_impl.h"
 
 #include <algorithm>
 #include <cassert>
 
-void Pbuf::flush()
+void Obuf::flush()
 {
-  _sink->write(_b, _p);
-  _p = 0;
+  if (_n)
+    _sink->write(_iov, _n);
+  _n = 0;
 }
 
-void Pbuf::checknflush(int n)
+void Obuf::add(char const *str, unsigned long len)
 {
-  char *x = 0;
-  assert(_p + n <= size());
-  x = (char*)memchr(_b, '\n', _p + n);
-
-  if (x)
-    {
-      int rem = n - (x - _b + 1 - _p);
-      _p = x - _b + 1;
-      flush();
-      if (rem)
-        memmove(_b, x + 1, rem);
-      _p = rem;
-    }
-  else
-    _p += n;
-}
+  if (!len)
+    return;
 
-void Pbuf::printf(char const *fmt, ...)
-{
-  if (!fits(strlen(fmt) + 50))
+  if (_n == Max_iov)
     flush();
-  int n;
-  va_list arg;
-  va_start(arg, fmt);
-  n = vsnprintf(_b + _p, size() - _p, fmt, arg);
-  va_end(arg);
-  if (n > 0)
-    checknflush(std::min<unsigned long>(n, size() - _p));
-}
 
-void Pbuf::outnstring(char const *str, unsigned long len)
-{
-  assert(len <= size());
-  if (!fits(len))
-    flush();
-  memcpy(_b + _p, str, len);
-  checknflush(len);
+  _iov[_n].buf = str;
+  _iov[_n].len = len;
+  ++_n;
 }
 
 namespace {
@@ -82,28 +56,24 @@ Mux_i::Mux_i(Controller *ctl, char const *name)
 void
 Mux_i::do_client_output(Client const *v, int taillines, bool add_nl)
 {
-  Client::Buf const *b = v->wbuf();
-  Client::Buf::Index p = b->tail();
-  if (taillines != -1)
-    {
-      p = b->head();
-      while (taillines--)
-        {
-          p = b->find_backwards('\n', p);
-          if (p == b->tail())
-            break;
-        }
+  History h(v);
+  unsigned long start = taillines == -1 ? h.start() : h.tail(taillines);
 
-      if (p != b->head() && (*b)[p] == '\n')
-        ++p;
+  History::Reader r(h, start);
+  unsigned si = v->find_stamp(start);
+  char const *d;
+  while (unsigned l = r.next(&d))
+    {
+      v->write_stamped(start, d, l, &si, _self_client);
+      start += l;
     }
 
-  b->write(p, b->head(), _self_client);
   flush(_self_client);
 
   if (add_nl)
     {
-      p = b->head();
+      Client::Buf const *b = v->wbuf();
+      Client::Buf::Index p = b->head();
       if (p != b->tail() && (*b)[--p] != '\n')
         write("\r\n", 2);
     }
@@ -121,18 +91,46 @@ Mux_i::tail(Client *v, int numlines, bool add_nl)
   do_client_output(v, numlines, add_nl);
 }
 
+/**
+ * Write the start of a tagged output line of a client.
+ *
+ * The color escape sequence and the padded tag are rendered once and kept
+ * with the client until the tag length changes.
+ *
+ * \param client    Client to write the tag of.
+ * \param new_line  Terminate the preempted line of another client first.
+ */
 void
-Mux_i::write_tag(Client *client)
+Mux_i::write_tag(Client *client, bool new_line)
 {
-  std::string const & n = client->tag();
-  ob.outnstring(n.c_str(), cxx::min<unsigned long>(n.size(), _tag_len));
-  if (n.size() < _tag_len)
-    ob.outnstring("             ", _tag_len - n.size());
+  Client::Line_prefix *p = client->line_prefix();
+  if (p->tag_len != _tag_len)
+    {
+      int color = client->color();
+      char b[16];
+      if (color)
+        p->color_len = snprintf(b, sizeof(b), "\033[%s3%dm",
+                                (color & 8) ? "01;" : "", (color & 7));
+      else
+        p->color_len = snprintf(b, sizeof(b), "\033[0m");
+
+      std::string const &n = client->tag();
+      p->s.assign(b, p->color_len);
+      p->s.append(n, 0, _tag_len);
+      if (n.size() < _tag_len)
+        p->s.append(_tag_len - n.size(), ' ');
+      p->tag_len = _tag_len;
+    }
+
+  ob.add(p->s.data(), p->color_len);
+  if (new_line)
+    ob.add("\r\n", 2);
+  ob.add(p->s.data() + p->color_len, p->s.size() - p->color_len);
 
   if (client->output_line_preempted())
-    ob.printf(": ");
+    ob.add(": ", 2);
   else
-    ob.printf("| ");
+    ob.add("| ", 2);
 }
 
 void
@@ -152,38 +150,36 @@ Mux_i::write(Client *client, const char *msg, unsigned len_msg)
       && _last_output_client->output_line_preempted()
       && _last_output_client->color()
       && tagged)
-    ob.printf("\033[0m");
+    ob.add("\033[0m", 4);
 
   int input_check_cnt = 0;
   while (len_msg > 0 && msg[0])
     {
       if (_last_output_client != client)
         {
-          if (tagged && color)
-            ob.printf("\033[%s3%dm", (color & 8) ? "01;" : "", (color & 7));
-          else
-            ob.printf("\033[0m");
-
-          if (_last_output_client != 0)
-            ob.printf("\r\n");
-
           if (tagged)
-            write_tag(client);
+            write_tag(client, _last_output_client != 0);
+          else
+            {
+              ob.add("\033[0m", 4);
+              if (_last_output_client != 0)
+                ob.add("\r\n", 2);
+            }
         }
 
-      long i;
-      for (i = 0; i < (long)len_msg; ++i)
-        if (msg[i] == '\n' || msg[i] == 0 || i == (long)ob.size())
-          break;
+      char const *e = static_cast<char const *>(memchr(msg, '\n', len_msg));
+      long i = e ? e - msg : len_msg;
+      if ((e = static_cast<char const *>(memchr(msg, 0, i))))
+        i = e - msg;
 
-      ob.outnstring(msg, i);
+      ob.add(msg, i);
 
       if (i < (long)len_msg && msg[i] == '\n')
         {
           if (tagged && color)
-            ob.printf("\033[0m\n");
+            ob.add("\033[0m\n", 5);
           else
-            ob.printf("\n");
+            ob.add("\n", 1);
           client->output_line_done();
           _last_output_client = 0;
           ++i;
@@ -204,12 +200,17 @@ Mux_i::write(Client *client, const char *msg, unsigned len_msg)
                i != _fe.end(); ++i)
             if (i->check_input())
               {
-                ob.printf("[Got input, stopping output.]\n");
+                static char const stop[] = "[Got input, stopping output.]\n";
+                ob.add(stop, sizeof(stop) - 1);
+                ob.flush();
                 return;
               }
           input_check_cnt = 0;
         }
     }
+
+  // The batch refers to the message, which is only valid during this call.
+  ob.flush();
 }
 
 
@@ -223,15 +224,39 @@ Mux_i::vprintf(const char *fmt, va_list args)
   return n;
 }
 
+void
+Mux_i::print(char const *s, unsigned len)
+{
+  _self_client->cooked_write(s, len);
+}
+
 void
 Mux_i::add_frontend(Frontend *f)
 {
   f->input_mux(this);
+  if (_sif)
+    f->flush_delay(_flush_delay, _sif);
   _fe.add(f);
   if (!is_connected())
     prompt();
 }
 
+void
+Mux_i::frontend_info()
+{
+  for (Fe_iter i = _fe.begin(); i != _fe.end(); ++i)
+    i->info(this);
+}
+
+void
+Mux_i::flush_delay(unsigned us, L4::Ipc_svr::Server_iface *sif)
+{
+  _flush_delay = us;
+  _sif = sif;
+  for (Fe_iter i = _fe.begin(); i != _fe.end(); ++i)
+    i->flush_delay(us, sif);
+}
+
 int
 Mux_i::vsys_msg(const char *fmt, va_list args)
 {
@@ -331,10 +356,30 @@ Mux_i::inject_to_read_buffer(char c)
 
   bool do_trigger = _connected->rbuf()->put(c);
   if (_connected->attr()->l_flags & L4_VCON_ECHO)
-    write(&c, 1);
+    {
+      if (_echo_len == sizeof(_echo))
+        flush_echo();
+      _echo[_echo_len++] = c;
+    }
   return do_trigger;
 }
 
+void
+Mux_i::flush_echo()
+{
+  if (_echo_len)
+    write(_echo, _echo_len);
+  _echo_len = 0;
+}
+
+void
+Mux_i::input_done(bool trigger)
+{
+  flush_echo();
+  if (trigger)
+    _connected->trigger();
+}
+
 bool
 Mux_i::handle_cmd_seq_global(const char k)
 {
@@ -361,19 +406,14 @@ Mux_i::handle_cmd_seq_global(const char k)
       break;
     default:
         {
-          Controller::Client_iter c
-            = std::find_if(_ctl->clients.begin(),
-                           Controller::Client_iter(_ctl->clients.end()),
-                           Client::Equal_key(Client::Key(k)));
-
-          if (c != _ctl->clients.end())
+          if (Client *c = _ctl->find_client(Client::Key(k)))
             {
-              if (*c != _connected)
+              if (c != _connected)
                 {
                   disconnect(_connected, false);
                   printf("------------- Connecting to '%s' -------------\n",
-                         (*c)->tag().c_str());
-                  connect(*c);
+                         c->tag().c_str());
+                  connect(c);
                   return true;
                 }
             }
@@ -386,11 +426,18 @@ Mux_i::handle_cmd_seq_global(const char k)
 void
 Mux_i::clear_seq_print(bool erase)
 {
+  flush_echo();
   for (unsigned a = 0; a < strlen(_seq_str); ++a)
     _connected->write(erase ? "\b \b" : "\b");
   flush(_connected);
 }
 
+/**
+ * Feed input to the connected client.
+ *
+ * The echo of the input is written and the client is triggered once for
+ * the whole chunk, or before the connected client changes.
+ */
 void
 Mux_i::handle_vcon_input(cxx::String const &buf)
 {
@@ -406,6 +453,7 @@ Mux_i::handle_vcon_input(cxx::String const &buf)
           switch (buf[i])
             {
             case '.':
+              input_done(do_trigger);
               disconnect(_connected);
               handle_prompt_input(buf.substr(i + 1));
               return;
@@ -433,8 +481,14 @@ Mux_i::handle_vcon_input(cxx::String const &buf)
               break;
             default:
               clear_seq_print(true);
+              input_done(do_trigger);
+              do_trigger = false;
               if (handle_cmd_seq_global(buf[i]))
-                return;
+                {
+                  // The rest of the input goes to the new client.
+                  handle_vcon_input(buf.substr(i + 1));
+                  return;
+                }
 
               do_trigger |= inject_to_read_buffer(5);
               break;
@@ -442,16 +496,16 @@ Mux_i::handle_vcon_input(cxx::String const &buf)
         }
       else if (buf[i] == 5) // ctrl-e
         {
+          flush_echo();
           _connected->write(_seq_str);
           flush(_connected);
           _inp.in_cmd_seq++;
         }
       else
         do_trigger |= inject_to_read_buffer(buf[i]);
-
-      if (do_trigger)
-        _connected->trigger();
     }
+
+  input_done(do_trigger);
 }
 
 void
@@ -464,8 +518,12 @@ Mux_i::handle_prompt_input(cxx::String const &buf)
     {
       if (_inp.in_cmd_seq)
         {
-          handle_cmd_seq_global(buf[i]);
           _inp.in_cmd_seq = 0;
+          if (handle_cmd_seq_global(buf[i]))
+            {
+              handle_vcon_input(buf.substr(i + 1));
+              return;
+            }
         }
       else if (_inp.esc.in_seq)
         {
@@ -549,8 +607,13 @@ Mux_i::handle_prompt_input(cxx::String const &buf)
               w("\r\n");
               _ctl->cmd(this, _inp.string());
               _inp.clear();
-              if (!is_connected())
-                prompt();
+              if (is_connected())
+                {
+                  // The rest of the input goes to the connected client.
+                  handle_vcon_input(buf.substr(i + 1));
+                  return;
+                }
+              prompt();
               break;
             case 127: // BS
               if (_inp.p)
@@ -563,13 +626,13 @@ Mux_i::handle_prompt_input(cxx::String const &buf)
               _inp.esc.in_seq++;
               break;
             default:
-              _inp.add(buf[i]);
-              write(&buf[i], 1);
+              if (!_inp.full())
+                {
+                  _inp.add(buf[i]);
+                  write(&buf[i], 1);
+                }
             };
         }
-
-      if (_inp.full())
-        break;
     }
 }
 
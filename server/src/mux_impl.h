@@ -7,6 +7,7 @@
  */
 #pragma once
 
+#include "frontend.h"
 #include "mux.h"
 #include "controller.h"
 
@@ -16,42 +17,46 @@
 #include <cstring>
 #include <cstdio>
 
-class Pbuf
+/**
+ * Batch of output fragments for the frontends.
+ *
+ * The fragments are not copied, they must stay valid until the batch is
+ * flushed.
+ */
+class Obuf
 {
 public:
   class Sink
   {
   public:
-    virtual void write(char const *buf, unsigned size) const = 0;
+    virtual void write(Frontend::Iov const *iov, unsigned cnt) const = 0;
   };
 
-  explicit Pbuf(Sink *sink) : _p(0), _sink(sink) {}
-  unsigned long size() const { return sizeof(_b); }
+  explicit Obuf(Sink *sink) : _n(0), _sink(sink) {}
   void flush();
-  void printf(char const *fmt, ...) __attribute__((format(printf, 2, 3)));
-  void outnstring(char const *str, unsigned long len);
+  void add(char const *str, unsigned long len);
 
 private:
-  bool fits(unsigned l) const { return (_p + l) < sizeof(_b); }
-  void checknflush(int n);
+  enum { Max_iov = 64 };
 
-  char _b[1024];
-  unsigned long _p;
+  Frontend::Iov _iov[Max_iov];
+  unsigned _n;
   Sink *_sink;
 };
 
-class Mux_i : public Mux, private Pbuf::Sink
+class Mux_i : public Mux, private Obuf::Sink
 {
 public:
   explicit Mux_i(Controller *ctl, char const *name);
   ~Mux_i() { delete _self_client; }
 
-  void write_tag(Client *client);
+  void write_tag(Client *client, bool new_line);
   void write(Client *tag, const char *msg, unsigned len_msg) override;
   void flush(Client *tag) override;
 
   int vsys_msg(const char *fmt, va_list args) override;
   int vprintf(const char *fmt, va_list args) override;
+  void print(char const *s, unsigned len) override;
 
   void show(Client *c) override;
   void hide(Client *c) override;
@@ -60,9 +65,16 @@ public:
 
   void input(cxx::String const &buf) override;
   void add_frontend(Frontend *f) override;
+  void frontend_info() override;
   void cat(Client *c, bool add_nl) override;
   void tail(Client *tag, int numlines, bool add_nl) override;
 
+  /**
+   * Let the frontends of this mux hold back output for at most `us`
+   * microseconds to write it in larger chunks.
+   */
+  void flush_delay(unsigned us, L4::Ipc_svr::Server_iface *sif);
+
   bool is_connected() const { return _connected != _self_client; }
   char const *name() const override { return _name; }
 
@@ -126,34 +138,37 @@ private:
   bool handle_cmd_seq_global(const char k);
   void clear_seq_print(bool erase);
   bool inject_to_read_buffer(char c);
+  void flush_echo();
+  void input_done(bool trigger);
 
   void do_client_output(Client const *v, int taillines, bool add_nl);
 
+  void write(char const *buf, unsigned size) const
+  {
+    Frontend::Iov iov = { buf, size };
+    write(&iov, 1);
+  }
+
   // Sink::write
-  void write(char const *buf, unsigned size) const override
+  void write(Frontend::Iov const *iov, unsigned cnt) const override
   {
     for (Fe_iter i = const_cast<Fe_list&>(_fe).begin(); i != _fe.end(); ++i)
-      {
-        for (unsigned l = 0; l < size; )
-          {
-            int r = i->write(buf + l, size - l);
-            if (r < 0)
-              break;
-
-            l += r;
-          }
-      }
+      i->write(iov, cnt);
   }
 
   Fe_list _fe;
 
   Client *_self_client;
-  Pbuf ob;
+  Obuf ob;
   Client *_last_output_client;
   Client *_connected;
   Output_mux *_pre_connect_output;
   unsigned _tag_len;
+  unsigned _flush_delay = 0;
+  L4::Ipc_svr::Server_iface *_sif = nullptr;
   Mux_input_buf _inp;
+  char _echo[128];
+  unsigned _echo_len = 0;
   Controller *_ctl;
   char const *_name;
   char const *_seq_str;
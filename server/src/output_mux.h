@@ -22,6 +22,8 @@ public:
 
   virtual int vprintf(const char *fmt, va_list args) = 0;
   int printf(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+  /// Like printf() for a string that needs no formatting, of any length.
+  virtual void print(char const *s, unsigned len) = 0;
   virtual char const *name() const = 0;
 
   virtual void show(Client *c) = 0;
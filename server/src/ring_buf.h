@@ -0,0 +1,659 @@
+/*
+ * Copyright (C) 2026 Kernkonzept GmbH.
+ *
+ * License: see LICENSE.spdx (in this directory or the directories above)
+ */
+#pragma once
+
+#include "mirror_mem.h"
+
+#include <l4/cxx/minmax>
+#include <l4/sys/consts.h>
+#include <l4/sys/l4int.h>
+
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+/**
+ * Index arithmetic for ring buffers of arbitrary size.
+ */
+struct Ring_wrap_mod
+{
+  static int size(size_t sz) { return sz; }
+
+  static int wrap(int i, int sz)
+  {
+    i %= sz;
+    return i < 0 ? i + sz : i;
+  }
+
+  static int inc(int i, int sz) { return ++i == sz ? 0 : i; }
+  static int dec(int i, int sz) { return (i == 0 ? sz : i) - 1; }
+
+  static int distance(int s, int e, int sz)
+  { return e >= s ? e - s : e + sz - s; }
+};
+
+/**
+ * Index arithmetic for ring buffers with a power-of-two size.
+ *
+ * The requested size is rounded up to the next power of two, so every index
+ * operation is a single mask.
+ */
+struct Ring_wrap_mask
+{
+  static int size(size_t sz)
+  {
+    size_t n = 1;
+    while (n < sz)
+      n <<= 1;
+    return n;
+  }
+
+  static int wrap(int i, int sz) { return i & (sz - 1); }
+  static int inc(int i, int sz) { return (i + 1) & (sz - 1); }
+  static int dec(int i, int sz) { return (i - 1) & (sz - 1); }
+
+  static int distance(int s, int e, int sz)
+  { return (e - s) & (sz - 1); }
+};
+
+/**
+ * FIFO of small records, oldest first.
+ *
+ * The storage grows on demand up to the given maximum number of records and
+ * shrinks again when it is mostly unused. If the FIFO is full, adding a
+ * record drops the oldest one.
+ */
+template<typename T>
+class Fifo_ring
+{
+public:
+  /// \param max  Maximum number of records, at least 1.
+  explicit Fifo_ring(unsigned max = ~0U) : _max(max) {}
+
+  /**
+   * Change the maximum number of records, dropping the oldest records that
+   * exceed it.
+   */
+  void limit(unsigned max)
+  {
+    _max = max;
+    while (_count > _max)
+      pop_front();
+  }
+
+  unsigned size() const { return _count; }
+  bool empty() const { return !_count; }
+
+  T const &operator [] (unsigned i) const
+  { return _p[(_first + i) & (_p.size() - 1)]; }
+
+  T const &front() const { return (*this)[0]; }
+  T const &back() const { return (*this)[_count - 1]; }
+
+  void push_back(T const &v)
+  {
+    if (_count == _max)
+      pop_front();
+    if (_count == _p.size())
+      resize(_p.empty() ? Min_capacity : 2 * _p.size());
+    _p[(_first + _count++) & (_p.size() - 1)] = v;
+  }
+
+  void pop_front()
+  {
+    _first = (_first + 1) & (_p.size() - 1);
+    --_count;
+    if (_p.size() > Min_capacity && _count < _p.size() / 4)
+      resize(_p.size() / 2);
+  }
+
+private:
+  enum { Min_capacity = 64 };
+
+  /// \param n  New capacity, a power of two not below the record count.
+  void resize(unsigned n)
+  {
+    std::vector<T> p(n);
+    for (unsigned i = 0; i < _count; ++i)
+      p[i] = (*this)[i];
+    _p.swap(p);
+    _first = 0;
+  }
+
+  std::vector<T> _p;
+  unsigned _first = 0, _count = 0;
+  unsigned _max;
+};
+
+/// Ring of 32-bit byte positions.
+typedef Fifo_ring<l4_uint32_t> Pos_ring;
+
+/**
+ * Receiver of data that is about to be overwritten in a Ring_buf.
+ */
+class Ring_evict_sink
+{
+public:
+  /**
+   * Take over a run of evicted bytes.
+   *
+   * Runs are handed over oldest first and without gaps.
+   */
+  virtual void evict(char const *d, unsigned len) = 0;
+
+protected:
+  ~Ring_evict_sink() = default;
+};
+
+/**
+ * Circular byte buffer keeping the most recent output or input of a client.
+ *
+ * The buffer is either allocated from the heap or, if requested, backed by
+ * memory that is mapped twice back to back (see Mirror_mem). In the latter
+ * case every range of the buffer is contiguous in memory and readers never
+ * have to handle the wrap point.
+ *
+ * The buffer also keeps an index of the newline characters it contains, so
+ * line boundaries can be found without scanning the content.
+ *
+ * Content can be handed to a Ring_evict_sink before it is overwritten.
+ * Besides the ring indices, content is addressed by absolute positions: the
+ * number of bytes ever put into the buffer before a given byte.
+ *
+ * \tparam W  Index arithmetic, either Ring_wrap_mask or Ring_wrap_mod.
+ */
+template<typename W>
+class Ring_buf
+{
+public:
+  /// Minimum number of bytes handed to the evict sink at once.
+  enum { Evict_chunk = 4096 };
+
+  class Index
+  {
+  public:
+    bool operator == (Index v) const { return v.i == i; }
+    bool operator != (Index v) const { return v.i != i; }
+
+    Index operator ++ ()
+    {
+      i = W::inc(i, _b->_bufsz);
+      return *this;
+    }
+
+    Index operator ++ (int)
+    {
+      int n = i;
+      ++(*this);
+      return Index(n, _b);
+    }
+
+    Index operator -- ()
+    {
+      i = W::dec(i, _b->_bufsz);
+      return *this;
+    }
+
+    Index operator + (int v)
+    {
+      return Index(W::wrap(i + v, _b->_bufsz), _b);
+    }
+
+    Index operator - (int v)
+    {
+      return this->operator+(-v);
+    }
+
+  private:
+    friend class Ring_buf;
+    explicit Index(int i, Ring_buf const *b) : i(i), _b(b) {}
+    int i;
+    Ring_buf const *_b;
+  };
+
+  /**
+   * Create a buffer.
+   *
+   * \param sz      Requested buffer size in bytes.
+   * \param mirror  Try to use a mirrored mapping as backing store. The size
+   *                is then rounded up to a multiple of the page size.
+   */
+  explicit Ring_buf(size_t sz, bool mirror = false)
+  : _bufsz(W::size(mirror ? l4_round_page(sz) : sz)),
+    // Every buffered byte holds at most one newline character.
+    _nl(_bufsz)
+  {
+    if (mirror && _mirror.alloc(_bufsz))
+      {
+        _buf = _mirror.addr();
+        return;
+      }
+
+    _buf = new char [_bufsz + 1];
+    // allocate another byte and set it to zero to prevent accidental
+    // out-of-bound reads due to wrongfully using the byte array as C-string.
+    memset(_buf + _bufsz, 0, 1);
+  }
+
+  Ring_buf() = delete;
+  ~Ring_buf()
+  {
+    if (!mirrored())
+      delete [] _buf;
+  }
+
+  /// True if any range of the buffer is contiguous in memory.
+  bool mirrored() const { return _mirror.addr(); }
+
+  /// Size of the buffer in bytes.
+  int capacity() const { return _bufsz; }
+
+  Index head() const { return Index(_head, this); }
+  Index tail() const { return Index(_tail, this); }
+
+  char operator [] (Index const &i) const { return _buf[i.i]; }
+
+  /**
+   * Get the contiguous memory run starting at a buffer position.
+   *
+   * \param      s  Start marker in this buffer.
+   * \param      e  Exclusive end marker in this buffer.
+   * \param[out] d  Start of the memory run.
+   *
+   * \return Length of the memory run. This is the full distance from `s` to
+   *         `e` for a mirrored buffer, otherwise the run ends at the wrap
+   *         point.
+   */
+  int span(Index const &s, Index const &e, char const **d) const
+  {
+    *d = _buf + s.i;
+    if (mirrored() || s.i <= e.i)
+      return distance(s, e);
+    return _bufsz - s.i;
+  }
+
+  /**
+   * Write buffer content to passed object.
+   *
+   * \tparam O  Type implementing the `write()` function.
+   *
+   * \param s  Start marker in this buffer.
+   * \param e  Exclusive end marker in this buffer.
+   * \param o  Object to write to.
+   */
+  template< typename O >
+  int write(Index const &s, Index const &e, O *o) const
+  {
+    int l = 0;
+    if (mirrored())
+      {
+        if (s.i != e.i)
+          l += o->write(_buf + s.i, distance(s, e));
+      }
+    else if (s.i < e.i)
+      l += o->write(_buf + s.i, e.i - s.i);
+    else if (s.i > e.i)
+      {
+        l += o->write(_buf + s.i, _bufsz - s.i);
+        l += o->write(_buf, e.i);
+      }
+    return l;
+  }
+
+  /**
+   * Place a break signal at the current head.
+   *
+   * Logically speaking, this adds content to the buffer and if the buffer
+   * was empty before, the client must be notified of the new data to read.
+   *
+   * \return True, iff the client needs to be notified.
+   */
+  bool put_break()
+  {
+    if (break_points.empty() || break_points.back() != _head)
+      break_points.push_back(_head);
+
+    return empty();
+  }
+
+  /**
+   * Check if the next break signal is at the given offset from tail.
+   *
+   * \param offset  Byte offset from tail.
+   *
+   * \retval True, iff the next break signal is registered there.
+   */
+  bool is_next_break(int offset) const
+  {
+    return    !break_points.empty()
+           && W::wrap(_tail + offset, _bufsz) == break_points[0];
+  }
+
+  /// Clear the next break signal in the queue.
+  void clear_next_break()
+  {
+    break_points.erase(break_points.begin());
+  }
+
+  /// Clear an old break signal located under the new _head marker.
+  void clear_break_on_overwrite()
+  {
+    if (!break_points.empty() && break_points[0] == _head)
+      clear_next_break();
+  }
+
+  /**
+   * Clear all old break signals the _head marker passes when advancing by
+   * `len` bytes.
+   */
+  void clear_breaks_on_overwrite(int len)
+  {
+    auto it = break_points.begin();
+    for (int passed = 0; it != break_points.end(); ++it)
+      {
+        int d = W::distance(_head, *it, _bufsz);
+        if (d == 0)
+          d = _bufsz;
+        if (d <= passed || d > len)
+          break;
+        passed = d;
+      }
+
+    break_points.erase(break_points.begin(), it);
+  }
+
+  bool put(char d)
+  {
+    bool was_empty = empty();
+
+    if (d == '\n')
+      {
+        ++_sum_lines;
+        _nl.push_back(_sum_bytes);
+      }
+
+    if (   _sink && distance() == _bufsz - 1
+        && long(_evicted - tail_pos()) <= 0)
+      evict(cxx::min(_sum_bytes, tail_pos() + Evict_chunk));
+
+    ++_sum_bytes;
+
+    _buf[_head] = d;
+    _head = W::inc(_head, _bufsz);
+
+    clear_break_on_overwrite();
+
+    if (_head == _tail)
+      {
+        _tail = W::inc(_tail, _bufsz);
+        drop_newlines();
+      }
+
+    return was_empty;
+  }
+
+  /**
+   * Append a span of bytes to the buffer.
+   *
+   * The data is copied in at most two runs (before and after the wrap
+   * point), overwriting the oldest content if necessary. Statistics and
+   * break signals are maintained exactly as if every byte had been added
+   * with put(char).
+   *
+   * \param d    Data to append.
+   * \param len  Number of bytes in `d`.
+   *
+   * \return True, iff the buffer was empty before.
+   */
+  bool put(const char *d, int len)
+  {
+    bool was_empty = empty();
+    if (len <= 0)
+      return was_empty;
+
+    // The buffer holds at most _bufsz - 1 bytes, so only the last part of
+    // an oversized span survives.
+    int const cap = _bufsz - 1;
+    bool overwrite = distance() + len > cap;
+
+    clear_breaks_on_overwrite(len);
+
+    int skip = len > cap ? len - cap : 0;
+
+    if (_sink && overwrite)
+      {
+        unsigned long new_tail = _sum_bytes + len - cap;
+        if (long(new_tail - _evicted) > 0)
+          evict(cxx::min(_sum_bytes, cxx::max(new_tail,
+                                              _evicted + Evict_chunk)));
+        if (skip)
+          {
+            _sink->evict(d, skip);
+            _evicted += skip;
+          }
+      }
+
+    int pos = W::wrap(_head + skip, _bufsz);
+    _sum_lines += count_nl(d, skip);
+    _sum_bytes += skip;
+    d += skip;
+    len -= skip;
+
+    for (char const *p = d, *e = d + len;
+         (p = static_cast<char const *>(memchr(p, '\n', e - p))); ++p)
+      {
+        ++_sum_lines;
+        _nl.push_back(_sum_bytes + (p - d));
+      }
+
+    _sum_bytes += len;
+
+    if (mirrored())
+      memcpy(_buf + pos, d, len);
+    else
+      {
+        int first = cxx::min(len, _bufsz - pos);
+        memcpy(_buf + pos, d, first);
+        memcpy(_buf, d + first, len - first);
+      }
+
+    _head = W::wrap(pos + len, _bufsz);
+    if (overwrite)
+      {
+        _tail = W::inc(_head, _bufsz);
+        drop_newlines();
+      }
+
+    return was_empty;
+  }
+
+  /**
+   * Return the longest continuous number of bytes in the buffer. This is not
+   * a C-style string.
+   *
+   * \param      offset  Offset from current start of the buffer.
+   * \param[out] d       Character array without terminating NULL character.
+   *
+   * When the buffer wrapped around, the returned array ends at the end of
+   * the buffer.
+   *
+   * \retval Array length.
+   */
+  int get(int offset, char const **d) const
+  {
+    if (offset < 0 || (unsigned)offset >= _sum_bytes)
+      return 0;
+
+    offset = W::wrap(_tail + offset, _bufsz);
+    *d = &_buf[offset];
+
+    if (mirrored())
+      return W::distance(offset, _head, _bufsz);
+    if (offset > _head)
+      return _bufsz - offset;
+    return _head - offset;
+  }
+
+  Index find_backwards(char v, Index p) const
+  {
+    while (p != tail())
+      {
+        --p;
+        if ((*this)[p] == v)
+          return p;
+      }
+
+    return p;
+  }
+
+  Index find_forwards(char v, Index p) const
+  {
+    while (p != head())
+      {
+        if ((*this)[p] == v)
+          return p;
+        ++p;
+      }
+
+    return p;
+  }
+
+  bool empty() const { return head() == tail(); }
+
+  int distance() const { return distance(tail(), head()); }
+
+  int distance(Index start, Index end) const
+  { return W::distance(start.i, end.i, _bufsz); }
+
+  void clear(int l)
+  {
+    if (distance() >= _bufsz)
+      _tail = _head;
+    else
+      _tail = W::wrap(_tail + l, _bufsz);
+
+    drop_newlines();
+  }
+
+  /// Number of newline characters in the buffer.
+  unsigned newlines() const { return _nl.size(); }
+
+  /**
+   * Get the position of a newline character.
+   *
+   * \param n  Number of the newline character, counted from the oldest one
+   *           in the buffer. Must be smaller than newlines().
+   */
+  Index newline(unsigned n) const
+  {
+    int age = l4_uint32_t(_sum_bytes) - _nl[n];
+    return Index(W::wrap(_head - age, _bufsz), this);
+  }
+
+  /**
+   * Get the absolute position of a newline character.
+   *
+   * \param n  Number of the newline character, see newline().
+   */
+  unsigned long newline_pos(unsigned n) const
+  { return _sum_bytes - (l4_uint32_t(_sum_bytes) - _nl[n]); }
+
+  /// Absolute position of the head.
+  unsigned long head_pos() const { return _sum_bytes; }
+
+  /// Absolute position of the oldest byte in the buffer.
+  unsigned long tail_pos() const { return _sum_bytes - distance(); }
+
+  /**
+   * Get the index of an absolute position.
+   *
+   * \param pos  Position between tail_pos() and head_pos().
+   */
+  Index at(unsigned long pos) const
+  { return Index(W::wrap(_head - int(_sum_bytes - pos), _bufsz), this); }
+
+  /**
+   * Hand content to `sink` before it is overwritten.
+   *
+   * Content is handed over in runs of at least Evict_chunk bytes (unless
+   * bigger than the buffer), so some bytes may still be in this buffer after
+   * they have been handed over. Bytes dropped with clear() are not handed
+   * over.
+   */
+  void evict_sink(Ring_evict_sink *sink)
+  {
+    _sink = sink;
+    _evicted = tail_pos();
+  }
+
+  unsigned long stat_bytes() const { return _sum_bytes; }
+  unsigned long stat_lines() const { return _sum_lines; }
+
+private:
+  /// Count the newline characters in `d` one machine word at a time.
+  static unsigned long count_nl(char const *d, int len)
+  {
+    typedef unsigned long Word;
+    Word const ones = ~Word(0) / 0xff;
+    Word const nl = ones * '\n';
+    Word const low7 = ones * 0x7f;
+    unsigned long n = 0;
+    int i = 0;
+
+    for (; i + (int)sizeof(Word) <= len; i += sizeof(Word))
+      {
+        Word w;
+        memcpy(&w, d + i, sizeof(w));
+        w ^= nl;
+        // The high bit of each byte is set iff that byte was zero.
+        n += __builtin_popcountl(~(((w & low7) + low7) | w | low7));
+      }
+
+    for (; i < len; ++i)
+      n += d[i] == '\n';
+
+    return n;
+  }
+
+  /// Hand the content up to absolute position `upto` to the evict sink.
+  void evict(unsigned long upto)
+  {
+    if (long(_evicted - tail_pos()) < 0)
+      _evicted = tail_pos();
+
+    Index s = at(_evicted);
+    Index const e = at(upto);
+    while (s != e)
+      {
+        char const *d;
+        int l = span(s, e, &d);
+        _sink->evict(d, l);
+        s = s + l;
+      }
+
+    _evicted = upto;
+  }
+
+  /// Remove newline positions that are no longer inside the buffer.
+  void drop_newlines()
+  {
+    l4_uint32_t used = distance();
+    while (!_nl.empty() && l4_uint32_t(_sum_bytes) - _nl.front() > used)
+      _nl.pop_front();
+  }
+
+  Ring_buf(Ring_buf const &) = delete;
+  Ring_buf &operator = (Ring_buf const &) = delete;
+  char *_buf;
+  int _bufsz;
+  Mirror_mem _mirror;
+  int _head = 0, _tail = 0;
+  std::vector<int> break_points;
+  unsigned long _sum_bytes = 0, _sum_lines = 0;
+  Pos_ring _nl;
+  Ring_evict_sink *_sink = nullptr;
+  unsigned long _evicted = 0;
+};
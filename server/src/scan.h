@@ -0,0 +1,251 @@
+/*
+ * Copyright (C) 2026 Kernkonzept GmbH.
+ *
+ * License: see LICENSE.spdx (in this directory or the directories above)
+ */
+#pragma once
+
+#include <l4/sys/l4int.h>
+
+#include <cstring>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/**
+ * Find the first line control character (\n or \r).
+ *
+ * Scans 32 or 16 bytes per step with AVX2, SSE2 or NEON, and one machine
+ * word per step otherwise.
+ *
+ * \param p  Start of the data.
+ * \param e  End of the data.
+ *
+ * \return Pointer to the first \n or \r, `e` if there is none.
+ */
+inline char const *
+find_eol(char const *p, char const *e)
+{
+#if defined(__AVX2__)
+  __m256i const nl = _mm256_set1_epi8('\n');
+  __m256i const cr = _mm256_set1_epi8('\r');
+  for (; e - p >= 32; p += 32)
+    {
+      __m256i v = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(p));
+      unsigned m = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, nl),
+                                                        _mm256_cmpeq_epi8(v, cr)));
+      if (m)
+        return p + __builtin_ctz(m);
+    }
+#endif
+
+#if defined(__SSE2__)
+  __m128i const nl16 = _mm_set1_epi8('\n');
+  __m128i const cr16 = _mm_set1_epi8('\r');
+  for (; e - p >= 16; p += 16)
+    {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<__m128i const *>(p));
+      unsigned m = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, nl16),
+                                                  _mm_cmpeq_epi8(v, cr16)));
+      if (m)
+        return p + __builtin_ctz(m);
+    }
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+  uint8x16_t const nl16 = vdupq_n_u8('\n');
+  uint8x16_t const cr16 = vdupq_n_u8('\r');
+  for (; e - p >= 16; p += 16)
+    {
+      uint8x16_t v = vld1q_u8(reinterpret_cast<unsigned char const *>(p));
+      uint8x16_t m = vorrq_u8(vceqq_u8(v, nl16), vceqq_u8(v, cr16));
+      // Narrow to four bits per byte to get a scalar mask.
+      l4_uint64_t bits
+        = vget_lane_u64(vreinterpret_u64_u8(
+                          vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+      if (bits)
+        return p + (__builtin_ctzll(bits) >> 2);
+    }
+#else
+  typedef unsigned long Word;
+  Word const ones = ~Word(0) / 0xff;
+  Word const low7 = ones * 0x7f;
+  for (; e - p >= (long)sizeof(Word); p += sizeof(Word))
+    {
+      Word w;
+      memcpy(&w, p, sizeof(w));
+      Word a = w ^ (ones * '\n');
+      Word b = w ^ (ones * '\r');
+      // The high bit of each byte is set iff that byte was zero.
+      if (~(((a & low7) + low7) | a | low7) | ~(((b & low7) + low7) | b | low7))
+        break;
+    }
+#endif
+
+  for (; p != e; ++p)
+    if (*p == '\n' || *p == '\r')
+      return p;
+
+  return e;
+}
+
+/**
+ * Find the first position where a string of length `m` may start, judged
+ * by its first and last byte.
+ *
+ * Each of the two bytes may have one of two values, so that letters can be
+ * matched in either case. Checks 32 or 16 positions per step with AVX2,
+ * SSE2 or NEON.
+ *
+ * \param p       Start of the data.
+ * \param e       End of the data.
+ * \param m       Length of the string, at least 1.
+ * \param first0  First possible value of the first byte.
+ * \param first1  Second possible value of the first byte.
+ * \param last0   First possible value of the last byte.
+ * \param last1   Second possible value of the last byte.
+ *
+ * \return Pointer to the first candidate position, `e` if there is none.
+ */
+inline char const *
+find_first_last(char const *p, char const *e, unsigned long m,
+                char first0, char first1, char last0, char last1)
+{
+  if ((unsigned long)(e - p) < m)
+    return e;
+
+  // Last position a string of length m can start at.
+  char const *le = e - m + 1;
+  unsigned long const o = m - 1;
+
+#if defined(__AVX2__)
+  {
+    __m256i const f0 = _mm256_set1_epi8(first0);
+    __m256i const f1 = _mm256_set1_epi8(first1);
+    __m256i const l0 = _mm256_set1_epi8(last0);
+    __m256i const l1 = _mm256_set1_epi8(last1);
+    for (; le - p >= 32; p += 32)
+      {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(p));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(p + o));
+        __m256i fm = _mm256_or_si256(_mm256_cmpeq_epi8(a, f0),
+                                     _mm256_cmpeq_epi8(a, f1));
+        __m256i lm = _mm256_or_si256(_mm256_cmpeq_epi8(b, l0),
+                                     _mm256_cmpeq_epi8(b, l1));
+        unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(fm, lm));
+        if (mask)
+          return p + __builtin_ctz(mask);
+      }
+  }
+#endif
+
+#if defined(__SSE2__)
+  {
+    __m128i const f0 = _mm_set1_epi8(first0);
+    __m128i const f1 = _mm_set1_epi8(first1);
+    __m128i const l0 = _mm_set1_epi8(last0);
+    __m128i const l1 = _mm_set1_epi8(last1);
+    for (; le - p >= 16; p += 16)
+      {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<__m128i const *>(p));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<__m128i const *>(p + o));
+        __m128i fm = _mm_or_si128(_mm_cmpeq_epi8(a, f0), _mm_cmpeq_epi8(a, f1));
+        __m128i lm = _mm_or_si128(_mm_cmpeq_epi8(b, l0), _mm_cmpeq_epi8(b, l1));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(fm, lm));
+        if (mask)
+          return p + __builtin_ctz(mask);
+      }
+  }
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+  {
+    uint8x16_t const f0 = vdupq_n_u8(first0);
+    uint8x16_t const f1 = vdupq_n_u8(first1);
+    uint8x16_t const l0 = vdupq_n_u8(last0);
+    uint8x16_t const l1 = vdupq_n_u8(last1);
+    for (; le - p >= 16; p += 16)
+      {
+        uint8x16_t a = vld1q_u8(reinterpret_cast<unsigned char const *>(p));
+        uint8x16_t b = vld1q_u8(reinterpret_cast<unsigned char const *>(p + o));
+        uint8x16_t m = vandq_u8(vorrq_u8(vceqq_u8(a, f0), vceqq_u8(a, f1)),
+                                vorrq_u8(vceqq_u8(b, l0), vceqq_u8(b, l1)));
+        l4_uint64_t bits
+          = vget_lane_u64(vreinterpret_u64_u8(
+                            vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+        if (bits)
+          return p + (__builtin_ctzll(bits) >> 2);
+      }
+  }
+#else
+  if (first0 == first1)
+    {
+      // Let the C library find the first byte, it is usually vectorized.
+      for (; p < le; ++p)
+        {
+          p = static_cast<char const *>(memchr(p, first0, le - p));
+          if (!p)
+            return e;
+          if (p[o] == last0 || p[o] == last1)
+            return p;
+        }
+      return e;
+    }
+#endif
+
+  for (; p < le; ++p)
+    if ((*p == first0 || *p == first1) && (p[o] == last0 || p[o] == last1))
+      return p;
+
+  return e;
+}
+
+/**
+ * Count the newline characters in a range.
+ *
+ * \param p  Start of the data.
+ * \param e  End of the data.
+ */
+inline unsigned long
+count_nl(char const *p, char const *e)
+{
+  unsigned long n = 0;
+
+#if defined(__AVX2__)
+  __m256i const nl = _mm256_set1_epi8('\n');
+  for (; e - p >= 32; p += 32)
+    {
+      __m256i v = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(p));
+      n += __builtin_popcount(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl)));
+    }
+#endif
+
+#if defined(__SSE2__)
+  __m128i const nl16 = _mm_set1_epi8('\n');
+  for (; e - p >= 16; p += 16)
+    {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<__m128i const *>(p));
+      n += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl16)));
+    }
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+  uint8x16_t const nl16 = vdupq_n_u8('\n');
+  for (; e - p >= 16; p += 16)
+    {
+      uint8x16_t v = vld1q_u8(reinterpret_cast<unsigned char const *>(p));
+      // Each match is 0xff, count them as one each.
+      n += vaddvq_u8(vshrq_n_u8(vceqq_u8(v, nl16), 7));
+    }
+#else
+  while ((p = static_cast<char const *>(memchr(p, '\n', e - p))))
+    {
+      ++n;
+      if (++p == e)
+        break;
+    }
+  return n;
+#endif
+
+  for (; p != e; ++p)
+    n += *p == '\n';
+
+  return n;
+}
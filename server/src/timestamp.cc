@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2026 Kernkonzept GmbH.
+ *
+ * License: see LICENSE.spdx (in this directory or the directories above)
+ */
+#include "timestamp.h"
+
+#include <l4/re/env.h>
+#include <l4/sys/kip.h>
+
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <time.h>
+
+namespace {
+
+enum Format
+{
+  Wall_ms,   ///< [YYYY-MM-DD HH:MM:SS.mmm]
+  Wall,      ///< [YYYY-MM-DD HH:MM:SS]
+  Monotonic, ///< [sssss.uuuuuu] since boot
+};
+
+Format format_sel = Wall;
+
+/// Rendered prefix up to the fraction of the second `sec`.
+struct Second_cache
+{
+  long long sec = LLONG_MIN;
+  unsigned frac_digits;
+  int len;
+  char buf[Timestamp::Max_len];
+
+  void render(long long s)
+  {
+    sec = s;
+    frac_digits = 0;
+
+    if (format_sel == Monotonic)
+      {
+        len = snprintf(buf, sizeof(buf), "[%5lld.", s);
+        frac_digits = 6;
+        return;
+      }
+
+    time_t t = s;
+    struct tm *tt = localtime(&t);
+    if (!tt)
+      {
+        len = snprintf(buf, sizeof(buf), "[unknown");
+        return;
+      }
+
+    len = strftime(buf, sizeof(buf), "[%Y-%m-%d %T", tt);
+    if (format_sel == Wall_ms)
+      {
+        buf[len++] = '.';
+        frac_digits = 3;
+      }
+  }
+};
+
+Second_cache cache;
+
+/**
+ * Get the wall clock time in microseconds at KIP clock zero.
+ *
+ * The offset is taken with sub-second resolution and taken again once a
+ * second, so changes of the wall clock are picked up.
+ */
+long long
+wall_base()
+{
+  static long long base;
+  static l4_cpu_time_t synced;
+  static bool valid;
+
+  l4_cpu_time_t k = Timestamp::now();
+  if (valid && k - synced < 1000000)
+    return base;
+
+  timespec ts;
+  if (clock_gettime(CLOCK_REALTIME, &ts))
+    return base;
+
+  base = ts.tv_sec * 1000000LL + ts.tv_nsec / 1000 - (long long)k;
+  synced = k;
+  valid = true;
+  return base;
+}
+
+}
+
+bool
+Timestamp::set_format(char const *name)
+{
+  if (!strcmp(name, "wall-ms"))
+    format_sel = Wall_ms;
+  else if (!strcmp(name, "wall"))
+    format_sel = Wall;
+  else if (!strcmp(name, "monotonic"))
+    format_sel = Monotonic;
+  else
+    return false;
+
+  cache.sec = LLONG_MIN;
+  return true;
+}
+
+l4_cpu_time_t
+Timestamp::now()
+{ return l4_kip_clock(l4re_kip()); }
+
+int
+Timestamp::format(l4_cpu_time_t clock, char *buf)
+{
+  long long us = (long long)clock;
+  if (format_sel != Monotonic)
+    us += wall_base();
+
+  long long sec = us / 1000000;
+  if (sec != cache.sec)
+    cache.render(sec);
+
+  memcpy(buf, cache.buf, cache.len);
+  char *p = buf + cache.len;
+
+  // Fraction of the second, truncated to the digits of the format.
+  unsigned frac = us % 1000000;
+  for (unsigned i = cache.frac_digits; i < 6; ++i)
+    frac /= 10;
+  for (unsigned i = cache.frac_digits; i; --i, frac /= 10)
+    p[i - 1] = '0' + frac % 10;
+  p += cache.frac_digits;
+
+  *p++ = ']';
+  *p++ = ' ';
+  return p - buf;
+}
@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2026 Kernkonzept GmbH.
+ *
+ * License: see LICENSE.spdx (in this directory or the directories above)
+ */
+#pragma once
+
+#include <l4/sys/l4int.h>
+
+/**
+ * Rendering of line timestamps.
+ *
+ * Lines are stamped with the KIP clock when they arrive. The stamps are
+ * converted to the configured format only when the line is shown. The part
+ * of the prefix up to the fraction of a second is cached, so rendering the
+ * stamps of lines arriving in the same second is cheap.
+ */
+struct Timestamp
+{
+  enum { Max_len = 32 };
+
+  /**
+   * Select the format of the rendered timestamps.
+   *
+   * \param name  One of `wall` (the default), `wall-ms` or `monotonic`.
+   *
+   * \return False if `name` is not a known format.
+   */
+  static bool set_format(char const *name);
+
+  /// Current KIP clock value.
+  static l4_cpu_time_t now();
+
+  /**
+   * Render the line prefix for a timestamp.
+   *
+   * \param      clock  KIP clock value of the timestamp.
+   * \param[out] buf    Buffer of at least Max_len bytes.
+   *
+   * \return Length of the prefix.
+   */
+  static int format(l4_cpu_time_t clock, char *buf);
+};
@@ -8,12 +8,152 @@
 
 #include <l4/sys/typeinfo_svr>
 #include <l4/cxx/minmax>
+#include <l4/re/env>
+#include <l4/re/mem_alloc>
+#include <l4/re/rm>
+#include <l4/sys/kip.h>
+
+#include <cstring>
 
 unsigned Vcon_client::_dfl_obufsz = Vcon_client::Default_obuf_size;
 
+Vcon_client::~Vcon_client()
+{
+  if (!_ring)
+    return;
+
+  if (sif())
+    sif()->remove_timeout(&_ring_timeout);
+  _registry->unregister_obj(&_ring_irq);
+  L4Re::Env::env()->rm()->detach(reinterpret_cast<l4_addr_t>(_ring), 0);
+}
+
+bool
+Vcon_client::setup_ring(unsigned long size, L4Re::Util::Object_registry *r)
+{
+  L4Re::Env const *e = L4Re::Env::env();
+
+  l4_uint32_t sz = L4_PAGESIZE;
+  while (sz < size && sz < (1U << 30))
+    sz <<= 1;
+  unsigned long total = sizeof(Cons::Vcon_ring_hdr) + sz;
+
+  _ring_ds = L4Re::Util::make_unique_cap<L4Re::Dataspace>();
+  if (!_ring_ds.is_valid() || e->mem_alloc()->alloc(total, _ring_ds.get()) < 0)
+    {
+      _ring_ds.reset();
+      return false;
+    }
+
+  l4_addr_t addr = 0;
+  if (e->rm()->attach(&addr, total,
+                      L4Re::Rm::F::Search_addr | L4Re::Rm::F::Eager_map
+                      | L4Re::Rm::F::RW,
+                      L4::Ipc::make_cap_rw(_ring_ds.get())) < 0)
+    {
+      _ring_ds.reset();
+      return false;
+    }
+
+  if (!r->register_irq_obj(&_ring_irq))
+    {
+      e->rm()->detach(addr, 0);
+      _ring_ds.reset();
+      return false;
+    }
+
+  _registry = r;
+  _ring = reinterpret_cast<Cons::Vcon_ring_hdr *>(addr);
+  _ring_size = sz;
+  _ring->magic = Cons::Vcon_ring_hdr::Magic;
+  _ring->size = sz;
+  _ring->head = 0;
+  _ring->tail = 0;
+  return true;
+}
+
+long
+Vcon_client::op_ring(Cons::Vcon_ring::Rights,
+                     L4::Ipc::Cap<L4Re::Dataspace> &ds,
+                     L4::Ipc::Cap<L4::Irq> &doorbell)
+{
+  if (!_ring)
+    return -L4_ENODEV;
+
+  ds = L4::Ipc::make_cap_rw(_ring_ds.get());
+  doorbell = L4::Ipc::make_cap_rw(L4::cap_cast<L4::Irq>(_ring_irq.obj_cap()));
+  return L4_EOK;
+}
+
+/**
+ * Process the output the client placed in its log ring.
+ *
+ * At most one ring size is processed per call. If more is pending, the rest
+ * is processed in a later round of the server loop, so that a busy client
+ * cannot starve other clients.
+ */
+void
+Vcon_client::drain_ring()
+{
+  if (!_ring)
+    return;
+
+  char *data = _ring->data();
+  l4_uint32_t budget = _ring_size;
+  // The client may change the ring content while it is being parsed, so
+  // only parse a private copy.
+  char bounce[Ring_bounce_size];
+
+  for (;;)
+    {
+      l4_uint32_t head = __atomic_load_n(&_ring->head, __ATOMIC_ACQUIRE);
+      l4_uint32_t tail = _ring_tail;
+
+      // The ring is client memory, do not trust its content.
+      if (head - tail > _ring_size)
+        tail = head - _ring_size;
+
+      if (head == tail)
+        return;
+
+      if (!budget)
+        {
+          if (sif())
+            {
+              sif()->remove_timeout(&_ring_timeout);
+              sif()->add_timeout(&_ring_timeout, l4_kip_clock(l4re_kip()));
+            }
+          return;
+        }
+
+      while (tail != head && budget)
+        {
+          l4_uint32_t off = tail & (_ring_size - 1);
+          l4_uint32_t l = cxx::min(cxx::min(head - tail, _ring_size - off),
+                                   cxx::min<l4_uint32_t>(budget,
+                                                         sizeof(bounce)));
+          memcpy(bounce, data + off, l);
+          cooked_write(bounce, l);
+          tail += l;
+          budget -= l;
+        }
+
+      _ring_tail = tail;
+      __atomic_store_n(&_ring->tail, tail, __ATOMIC_RELEASE);
+      // Pairs with the barrier of the client after advancing head: either
+      // the client sees the new tail and rings the doorbell, or we see its
+      // new head in the next iteration.
+      __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    }
+}
+
 void
 Vcon_client::vcon_write(const char *buf, unsigned size) noexcept
-{ cooked_write(buf, size); }
+{
+  // Keep the order of output written to the ring before this call.
+  drain_ring();
+  cooked_write(buf, size);
+}
 
 unsigned
 Vcon_client::vcon_read(char *buf, unsigned const size) noexcept
@@ -85,6 +225,7 @@ int
 Vcon_client::vcon_set_attr(l4_vcon_attr_t const *a) noexcept
 {
   _attr = *a;
+  attr_changed();
   return 0;
 }
 
@@ -11,12 +11,15 @@
 #include "controller.h"
 #include "server.h"
 
+#include <l4/cons/vcon_ring>
 #include <l4/re/util/icu_svr>
 #include <l4/re/util/vcon_svr>
 #include <l4/re/util/object_registry>
+#include <l4/re/util/unique_cap>
+#include <l4/cxx/ipc_timeout_queue>
 
 class Vcon_client
-: public L4::Epiface_t<Vcon_client, L4::Vcon, Server_object>,
+: public L4::Epiface_t<Vcon_client, Cons::Vcon_ring, Server_object>,
   public L4Re::Util::Icu_cap_array_svr<Vcon_client>,
   public L4Re::Util::Vcon_svr<Vcon_client>,
   public Client
@@ -31,9 +34,26 @@ public:
               Controller *ctl)
   : Icu_svr(1, &_irq),
     Client(name, color, 512, bufsz < 512 ? _dfl_obufsz : bufsz, key,
-           line_buffering, line_buffering_ms, sif, ctl)
+           line_buffering, line_buffering_ms, sif, ctl),
+    _ring_irq(this), _ring_timeout(this)
   {}
 
+  ~Vcon_client();
+
+  /**
+   * Set up a shared-memory log ring for this session.
+   *
+   * \param size  Size of the ring data in bytes, rounded up to a power of
+   *              two.
+   * \param r     Registry to register the doorbell IRQ with.
+   *
+   * \return True if the ring is available.
+   */
+  bool setup_ring(unsigned long size, L4Re::Util::Object_registry *r);
+
+  long op_ring(Cons::Vcon_ring::Rights, L4::Ipc::Cap<L4Re::Dataspace> &ds,
+               L4::Ipc::Cap<L4::Irq> &doorbell);
+
   void vcon_write(const char *buffer, unsigned size) noexcept;
   unsigned vcon_read(char *buffer, unsigned size) noexcept;
 
@@ -44,7 +64,11 @@ public:
 
   void trigger() const override { _irq.trigger(); }
 
-  bool collected() override { return Client::collected(); }
+  bool collected() override
+  {
+    drain_ring();
+    return Client::collected();
+  }
 
   static void default_obuf_size(unsigned bufsz)
   {
@@ -52,7 +76,37 @@ public:
   }
 
 private:
-  enum { Default_obuf_size = 40960 };
+  struct Ring_irq : public L4::Irqep_t<Ring_irq>
+  {
+    explicit Ring_irq(Vcon_client *c) : c(c) {}
+    Vcon_client *c;
+    void handle_irq()
+    { c->drain_ring(); }
+  };
+
+  struct Ring_timeout : public L4::Ipc_svr::Timeout_queue::Timeout
+  {
+    explicit Ring_timeout(Vcon_client *c) : c(c) {}
+    Vcon_client *c;
+    void expired() override
+    { c->drain_ring(); }
+  };
+
+  void drain_ring();
+
+  enum
+  {
+    Default_obuf_size = 40960,
+    Ring_bounce_size = 512,   ///< Bytes copied out of the log ring at once.
+  };
   static unsigned _dfl_obufsz;
   Icu_svr::Irq _irq;
+
+  L4Re::Util::Object_registry *_registry = nullptr;
+  L4Re::Util::Unique_cap<L4Re::Dataspace> _ring_ds;
+  Cons::Vcon_ring_hdr *_ring = nullptr;
+  l4_uint32_t _ring_size = 0;
+  l4_uint32_t _ring_tail = 0;
+  Ring_irq _ring_irq;
+  Ring_timeout _ring_timeout;
 };
@@ -17,4 +17,7 @@ public:
   Vcon_fe(L4::Cap<L4::Vcon> con, L4Re::Util::Object_registry *r);
   int write(char const *buf, unsigned sz) override
   { return do_write(buf, sz); }
+
+  int write(Iov const *iov, unsigned cnt) override
+  { return do_write(iov, cnt); }
 };
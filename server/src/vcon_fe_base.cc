@@ -7,16 +7,73 @@
  */
 #include "vcon_fe_base.h"
 #include <l4/re/error_helper>
+#include <l4/cxx/minmax>
+#include <l4/re/env.h>
+#include <l4/sys/kip.h>
+
+#include <cstring>
+
+Vcon_fe_base *Vcon_fe_base::_pending;
 
 Vcon_fe_base::Vcon_fe_base(L4::Cap<L4::Vcon> con,
                            L4Re::Util::Object_registry *r)
-: _vcon(con)
+: _vcon(con), _flush_timeout(this)
 {
   r->register_irq_obj(this);
 }
 
-int
-Vcon_fe_base::do_write(char const *buf, unsigned sz)
+/**
+ * Read all pending input and hand it to the input mux in as few chunks as
+ * possible.
+ */
+void
+Vcon_fe_base::handle_irq()
+{
+  char buf[Input_buf_size];
+  unsigned p = 0;
+
+  for (;;)
+    {
+      unsigned sz = cxx::min<unsigned>(sizeof(buf) - p, L4_VCON_READ_SIZE);
+      int r = _vcon->read(buf + p, sz);
+      if (r <= 0)
+        break;
+
+      p += cxx::min<unsigned>(r, sz);
+      if ((unsigned)r <= sz)
+        break;
+
+      if (p == sizeof(buf))
+        {
+          if (_input)
+            _input->input(cxx::String(buf, p));
+          p = 0;
+        }
+    }
+
+  if (_input && p)
+    _input->input(cxx::String(buf, p));
+}
+
+/**
+ * Check for pending input while producing a lot of output.
+ *
+ * Polling costs an IPC to the vcon server, so poll at most once every
+ * Input_poll_us and assume no input otherwise.
+ */
+bool
+Vcon_fe_base::check_input()
+{
+  l4_cpu_time_t now = l4_kip_clock(l4re_kip());
+  if (now - _last_input_poll < Input_poll_us)
+    return false;
+
+  _last_input_poll = now;
+  return _vcon->read(0, 0) > 0;
+}
+
+void
+Vcon_fe_base::vcon_write(char const *buf, unsigned sz)
 {
   for (unsigned s = sz; s; )
     {
@@ -26,6 +83,90 @@ Vcon_fe_base::do_write(char const *buf, unsigned sz)
       s -= l;
       buf += l;
     }
+}
+
+void
+Vcon_fe_base::flush()
+{
+  if (_flush_armed)
+    {
+      _sif->remove_timeout(&_flush_timeout);
+      _flush_armed = false;
+    }
+
+  if (_op)
+    write_out(_obuf, _op);
+  _op = 0;
+}
+
+/**
+ * Arrange for the buffered output to be flushed, either at the end of the
+ * current server loop iteration or, with a flush delay, when the delay
+ * since the first buffered byte expired.
+ */
+void
+Vcon_fe_base::queue_flush()
+{
+  if (_flush_delay && _sif)
+    {
+      if (!_flush_armed)
+        {
+          _sif->add_timeout(&_flush_timeout,
+                            l4_kip_clock(l4re_kip()) + _flush_delay);
+          _flush_armed = true;
+        }
+      return;
+    }
+
+  if (_queued)
+    return;
+
+  _next_pending = _pending;
+  _pending = this;
+  _queued = true;
+}
+
+void
+Vcon_fe_base::flush_pending()
+{
+  while (_pending)
+    {
+      Vcon_fe_base *fe = _pending;
+      _pending = fe->_next_pending;
+      fe->_next_pending = nullptr;
+      fe->_queued = false;
+      fe->flush();
+    }
+}
+
+int
+Vcon_fe_base::do_write(char const *buf, unsigned sz)
+{
+  for (unsigned s = sz; s; )
+    {
+      unsigned n = cxx::min<unsigned>(s, Obuf_size - _op);
+      memcpy(_obuf + _op, buf, n);
+      _op += n;
+      buf += n;
+      s -= n;
+
+      if (_op == Obuf_size)
+        flush();
+    }
+
+  if (_op)
+    queue_flush();
+
+  return sz;
+}
+
+int
+Vcon_fe_base::do_write(Iov const *iov, unsigned cnt)
+{
+  int sz = 0;
+  for (unsigned i = 0; i < cnt; ++i)
+    sz += do_write(iov[i].buf, iov[i].len);
+
   return sz;
 }
 
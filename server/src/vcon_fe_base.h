@@ -12,6 +12,7 @@
 #include <l4/sys/vcon>
 #include <l4/re/util/object_registry>
 #include <l4/sys/cxx/ipc_epiface>
+#include <l4/cxx/ipc_timeout_queue>
 
 class Vcon_fe_base :
   public Frontend,
@@ -19,25 +20,75 @@ class Vcon_fe_base :
 {
 public:
   Vcon_fe_base(L4::Cap<L4::Vcon> con, L4Re::Util::Object_registry *r);
-  void handle_irq()
+  virtual void handle_irq();
+
+  void flush() override;
+  void flush_delay(unsigned us, L4::Ipc_svr::Server_iface *sif) override
   {
-    char buf[30];
-    const int sz = sizeof(buf);
-    int r;
-
-    do
-      {
-        r = _vcon->read(buf, sz);
-        if (_input && r > 0)
-          _input->input(cxx::String(buf, r > sz ? sz : r));
-      }
-    while (r > sz);
+    _flush_delay = us;
+    _sif = sif;
   }
 
+  /// True if any Vcon frontend has output waiting for flush_pending().
+  static bool output_pending() { return _pending; }
+
+  /**
+   * Flush the output of all Vcon frontends that are not subject to a flush
+   * delay.
+   *
+   * Called once per server loop iteration after the reply was sent, so that
+   * the output produced while handling a request is written with as few
+   * write calls as possible.
+   */
+  static void flush_pending();
+
 protected:
   int do_write(char const *buf, unsigned sz);
-  bool check_input() override { return _vcon->read(0, 0) > 0; }
+  int do_write(Iov const *iov, unsigned cnt);
+  bool check_input() override;
   void handle_pending_input();
 
+  /// Write buffered output to the vcon.
+  virtual void write_out(char const *buf, unsigned sz)
+  { vcon_write(buf, sz); }
+
+  void vcon_write(char const *buf, unsigned sz);
+
   L4::Cap<L4::Vcon> _vcon; // FIXME: could be an auto cap
+
+private:
+  enum
+  {
+    Obuf_size = 8 * L4_VCON_WRITE_SIZE,
+    Input_buf_size = 2048,
+    // Minimum time between two input polls by check_input().
+    Input_poll_us = 10000,
+  };
+
+  struct Flush_timeout : public L4::Ipc_svr::Timeout_queue::Timeout
+  {
+    explicit Flush_timeout(Vcon_fe_base *fe) : fe(fe) {}
+    void expired() override
+    {
+      fe->_flush_armed = false;
+      fe->flush();
+    }
+    Vcon_fe_base *fe;
+  };
+
+  void queue_flush();
+
+  char _obuf[Obuf_size];
+  unsigned _op = 0;
+
+  l4_cpu_time_t _last_input_poll = 0;
+
+  unsigned _flush_delay = 0;
+  L4::Ipc_svr::Server_iface *_sif = nullptr;
+  Flush_timeout _flush_timeout;
+  bool _flush_armed = false;
+
+  Vcon_fe_base *_next_pending = nullptr;
+  bool _queued = false;
+  static Vcon_fe_base *_pending;
 };
@@ -73,6 +73,7 @@ public:
     _attr.l_flags = 0;
     _attr.i_flags = 0;
     _attr.o_flags = 0;
+    attr_changed();
   }
 
   void register_single_driver_irq() override
@@ -30,6 +30,7 @@
 #pragma once
 
 #include "frontend.h"
+#include "output_mux.h"
 #include "server.h"
 
 #include <l4/re/util/object_registry>
@@ -37,8 +38,9 @@
 #include <l4/l4virtio/l4virtio>
 #include <l4/sys/cxx/ipc_epiface>
 
-#include <queue>
-#include <string>
+#include <l4/cxx/minmax>
+
+#include <cstring>
 
 class Virtio_console_fe
 : public L4virtio::Svr::Console::Device,
@@ -46,36 +48,67 @@ class Virtio_console_fe
   public L4::Epiface_t<Virtio_console_fe, L4virtio::Device, Server_object>
 {
 public:
-  Virtio_console_fe(L4Re::Util::Object_registry *r)
-  : L4virtio::Svr::Console::Device(0x100)
+  enum { Default_obuf_size = 0x4000 };
+
+  /**
+   * \param r            Registry for the device IRQ.
+   * \param obuf_size    Size of the buffer for output the driver did not
+   *                     accept yet, rounded up to a power of two.
+   * \param drop_oldest  On buffer overflow, discard the oldest instead of
+   *                     the new output.
+   */
+  Virtio_console_fe(L4Re::Util::Object_registry *r,
+                    unsigned obuf_size = Default_obuf_size,
+                    bool drop_oldest = false)
+  : L4virtio::Svr::Console::Device(0x100),
+    _drop_oldest(drop_oldest)
   {
     init_mem_info(4);
     r->register_irq_obj(irq_iface());
+
+    _obuf_size = 1;
+    while (_obuf_size < obuf_size)
+      _obuf_size <<= 1;
+    _obuf = new char[_obuf_size];
   }
 
+  ~Virtio_console_fe() { delete [] _obuf; }
+
+  /*
+   * Read all available input before handing it to the input mux.
+   */
   void rx_data_available(unsigned) override
   {
-    unsigned s = 0;
-    char buf[64];
-    do
+    char buf[2048];
+    unsigned p = 0;
+    for (;;)
       {
-        s = port_read(buf, 64);
-        _input->input(cxx::String(buf, s));
-      } while (s > 0);
+        unsigned s = port_read(buf + p, sizeof(buf) - p);
+        p += s;
+        if (p && (!s || p == sizeof(buf)))
+          {
+            _input->input(cxx::String(buf, p));
+            p = 0;
+          }
+
+        if (!s)
+          break;
+      }
   }
 
+  /*
+   * Hand buffered output to the driver, straight from the buffer.
+   */
   void tx_space_available(unsigned) override
   {
-    while (!_output_buffer.empty())
+    while (_head != _tail)
       {
-        std::string &output = _output_buffer.front();
-        unsigned sent_bytes = port_write(output.data(), output.length());
-        if (sent_bytes < output.length())
-          {
-            output = output.substr(sent_bytes);
-            break;
-          }
-        _output_buffer.pop();
+        unsigned off = _tail & (_obuf_size - 1);
+        unsigned l = cxx::min(_head - _tail, _obuf_size - off);
+        unsigned sent_bytes = port_write(_obuf + off, l);
+        _tail += sent_bytes;
+        if (sent_bytes < l)
+          break;
       }
   }
 
@@ -86,24 +119,100 @@ public:
    */
   int write(const char* buf, unsigned int sz) override
   {
-    if (!_output_buffer.empty())
+    unsigned s = 0;
+    if (_head == _tail)
+      s = port_write(buf, sz);
+
+    unsigned head = _head;
+    defer(buf + s, sz - s);
+    _deferred += _head - head;
+    return sz;
+  }
+
+  /*
+   * Collect the fragments in the buffer, so that they end up in as few
+   * virtqueue buffers as possible. A single fragment is handed to the driver
+   * directly.
+   */
+  int write(Iov const *iov, unsigned cnt) override
+  {
+    if (cnt == 1)
+      return write(iov[0].buf, iov[0].len);
+
+    unsigned head = _head;
+    int sz = 0;
+    for (unsigned i = 0; i < cnt; ++i)
       {
-        _output_buffer.push(std::string(buf, sz));
-        return sz;
+        defer(iov[i].buf, iov[i].len);
+        sz += iov[i].len;
       }
 
-    unsigned s = port_write(buf, sz);
-    if (s < sz)
-      _output_buffer.push(std::string(buf + s, sz - s));
+    tx_space_available(0);
+    // Only count what the driver did not take right away.
+    _deferred += cxx::min(_head - _tail, _head - head);
     return sz;
   }
 
+  void info(Output_mux *out) const override
+  {
+    out->printf("virtio console frontend: %lu bytes deferred, "
+                "%lu bytes dropped, %u/%u bytes buffered\n",
+                _deferred, _dropped, _head - _tail, _obuf_size);
+  }
+
+  /// Number of bytes that had to wait in the buffer.
+  unsigned long deferred() const { return _deferred; }
+  /// Number of bytes discarded because the buffer was full.
+  unsigned long dropped() const { return _dropped; }
+
   bool check_input() override { return false; }
 
   Server_iface *server_iface() const override
   { return L4::Epiface::server_iface(); }
 
   bool collected() override { return false; }
+
 private:
-  std::queue<std::string> _output_buffer;
+  /// Append output to the buffer, applying the overflow policy.
+  void defer(char const *buf, unsigned sz)
+  {
+    if (!sz)
+      return;
+
+    unsigned space = _obuf_size - (_head - _tail);
+    if (sz > space)
+      {
+        if (_drop_oldest)
+          {
+            if (sz > _obuf_size)
+              {
+                _dropped += sz - _obuf_size;
+                buf += sz - _obuf_size;
+                sz = _obuf_size;
+              }
+            _dropped += sz - space;
+            _tail += sz - space;
+          }
+        else
+          {
+            _dropped += sz - space;
+            sz = space;
+          }
+      }
+
+    unsigned off = _head & (_obuf_size - 1);
+    unsigned l = cxx::min(sz, _obuf_size - off);
+    memcpy(_obuf + off, buf, l);
+    memcpy(_obuf, buf + l, sz - l);
+    _head += sz;
+  }
+
+  char *_obuf;
+  unsigned _obuf_size;
+  unsigned _head = 0;
+  unsigned _tail = 0;
+  bool _drop_oldest;
+
+  unsigned long _deferred = 0;
+  unsigned long _dropped = 0;
 };